@@ -0,0 +1,349 @@
+// Package agent runs processes in a running container on behalf of runrootless.
+//
+// The agent is the runrootless binary itself, bind-mounted on /dev/proot/runrootless and
+// executed under PRoot as the process of the container. It listens on a unix socket in
+// a directory shared with the host. The processes it spawns are traced by the same PRoot
+// session, so they get the root emulation without starting another tracer.
+//
+// A client sends a Request along with its stdio file descriptors, and receives a Response
+// when the process exits. Until then, it may send Signal messages on the same connection.
+package agent
+
+import (
+	"encoding/json"
+	"fmt"
+	"net"
+	"os"
+	"os/exec"
+	"os/signal"
+	"path/filepath"
+	"strings"
+	"sync"
+	"syscall"
+
+	"github.com/pkg/errors"
+	"golang.org/x/sys/unix"
+)
+
+const (
+	// ContainerSocket is the path of the agent socket in the container.
+	// It is in the PRoot tmpfs, so that the socket goes away with the container.
+	ContainerSocket = "/dev/proot/agent.sock"
+	// maxMessageSize is the maximum size of a message, including the environment variables.
+	maxMessageSize = 1 << 20
+)
+
+// SocketPath returns the path of the agent socket of the container, as seen from the host.
+// pid is the pid of the init process of the container.
+func SocketPath(pid int) string {
+	return fmt.Sprintf("/proc/%d/root%s", pid, ContainerSocket)
+}
+
+// Request is a process to be spawned.
+// The empty Env and Cwd default to the ones of the main process, so that a client does not
+// need to know the process of the container.
+type Request struct {
+	Args []string `json:"args"`
+	Env  []string `json:"env"`
+	// ExtraEnv is appended to Env, or to the default environment.
+	ExtraEnv []string `json:"extraEnv,omitempty"`
+	Cwd      string   `json:"cwd"`
+}
+
+// Signal is sent by the client to signal the process.
+type Signal struct {
+	Signal int `json:"signal"`
+}
+
+// Response is sent by the agent when the process exits.
+type Response struct {
+	ExitCode int    `json:"exitCode"`
+	Error    string `json:"error,omitempty"`
+}
+
+// Serve listens on socketPath and spawns the requested processes.
+// The first process is main: if main is nil, the first request becomes main.
+// main gets the stdio of the agent, and the signals sent to the agent.
+// Serve returns the exit code of main once it exits, after killing the other processes,
+// as runc does for the processes executed in a container whose init has exited.
+func Serve(socketPath string, main *Request) (int, error) {
+	os.Remove(socketPath)
+	l, err := net.ListenUnix("unixpacket", &net.UnixAddr{Name: socketPath, Net: "unixpacket"})
+	if err != nil {
+		return 0, err
+	}
+	defer l.Close()
+	s := &server{procs: make(map[*os.Process]struct{}), main: main}
+	defer s.killAll()
+	exited := make(chan int, 1)
+	if main != nil {
+		cmd, err := command(s.withDefaults(main), [3]*os.File{os.Stdin, os.Stdout, os.Stderr})
+		if err != nil {
+			return 0, err
+		}
+		if err := cmd.Start(); err != nil {
+			return 0, err
+		}
+		stop := forwardAgentSignals(cmd.Process)
+		defer stop()
+		go func() { exited <- exitCode(cmd.Wait()) }()
+	}
+	accepted := make(chan *net.UnixConn)
+	go func() {
+		for {
+			conn, err := l.AcceptUnix()
+			if err != nil {
+				return
+			}
+			accepted <- conn
+		}
+	}()
+	first := main == nil
+	for {
+		select {
+		case code := <-exited:
+			return code, nil
+		case conn := <-accepted:
+			var onExit func(int)
+			if first {
+				first = false
+				onExit = func(code int) { exited <- code }
+			}
+			go s.handle(conn, onExit)
+		}
+	}
+}
+
+// server tracks the processes spawned for the requests.
+type server struct {
+	mu    sync.Mutex
+	procs map[*os.Process]struct{}
+	// main is the request of the main process, which provides the defaults of the other requests.
+	main *Request
+}
+
+// withDefaults returns req with the empty Env and Cwd replaced with the ones of main,
+// or of the agent if there is no main process yet.
+func (s *server) withDefaults(req *Request) *Request {
+	s.mu.Lock()
+	main := s.main
+	s.mu.Unlock()
+	r := *req
+	if len(r.Env) == 0 {
+		if main != nil && len(main.Env) != 0 {
+			r.Env = main.Env
+		} else {
+			r.Env = os.Environ()
+		}
+	}
+	if r.Cwd == "" && main != nil {
+		r.Cwd = main.Cwd
+	}
+	r.Env = append(append([]string(nil), r.Env...), r.ExtraEnv...)
+	r.ExtraEnv = nil
+	return &r
+}
+
+func (s *server) add(p *os.Process) {
+	s.mu.Lock()
+	s.procs[p] = struct{}{}
+	s.mu.Unlock()
+}
+
+func (s *server) remove(p *os.Process) {
+	s.mu.Lock()
+	delete(s.procs, p)
+	s.mu.Unlock()
+}
+
+func (s *server) killAll() {
+	s.mu.Lock()
+	defer s.mu.Unlock()
+	for p := range s.procs {
+		// the process is a session leader
+		syscall.Kill(-p.Pid, syscall.SIGKILL)
+	}
+}
+
+func (s *server) handle(conn *net.UnixConn, onExit func(int)) {
+	defer conn.Close()
+	res := s.serveConn(conn, onExit != nil)
+	if onExit != nil {
+		// main has exited
+		defer onExit(res.ExitCode)
+	}
+	data, _ := json.Marshal(res)
+	conn.Write(data)
+}
+
+// serveConn spawns the process of the request on conn, and waits for it.
+// isMain is true for the first request when the agent was started without a main process.
+func (s *server) serveConn(conn *net.UnixConn, isMain bool) Response {
+	buf := make([]byte, maxMessageSize)
+	oob := make([]byte, syscall.CmsgSpace(3*4))
+	n, oobn, flags, _, err := conn.ReadMsgUnix(buf, oob)
+	if err != nil {
+		return Response{ExitCode: 255, Error: err.Error()}
+	}
+	fds, err := parseRights(oob[:oobn])
+	if err != nil {
+		return Response{ExitCode: 255, Error: err.Error()}
+	}
+	// The kernel drops the descriptors that do not fit in oob, and sets MSG_CTRUNC.
+	if len(fds) != 3 || flags&syscall.MSG_CTRUNC != 0 {
+		for _, fd := range fds {
+			syscall.Close(fd)
+		}
+		return Response{ExitCode: 255, Error: "expected 3 file descriptors"}
+	}
+	var stdio [3]*os.File
+	for i, fd := range fds {
+		stdio[i] = os.NewFile(uintptr(fd), "")
+		defer stdio[i].Close()
+	}
+	var req Request
+	if err := json.Unmarshal(buf[:n], &req); err != nil {
+		return Response{ExitCode: 255, Error: err.Error()}
+	}
+	resolved := s.withDefaults(&req)
+	if isMain {
+		s.mu.Lock()
+		s.main = resolved
+		s.mu.Unlock()
+	}
+	cmd, err := command(resolved, stdio)
+	if err == nil {
+		// The process gets its own session, so that it is not affected by the console of the container.
+		cmd.SysProcAttr = &syscall.SysProcAttr{Setsid: true}
+		err = cmd.Start()
+	}
+	if err != nil {
+		return Response{ExitCode: 127, Error: err.Error()}
+	}
+	s.add(cmd.Process)
+	defer s.remove(cmd.Process)
+	go forwardSignals(conn, cmd.Process)
+	return Response{ExitCode: exitCode(cmd.Wait())}
+}
+
+// forwardAgentSignals forwards the signals sent to the agent, e.g. by 'runc kill', to main.
+// SIGINT and SIGQUIT are not forwarded if stdin is a terminal, as the terminal sends them
+// to main as well.
+func forwardAgentSignals(main *os.Process) (stop func()) {
+	sigs := []os.Signal{syscall.SIGTERM, syscall.SIGHUP, syscall.SIGUSR1, syscall.SIGUSR2}
+	if _, err := unix.IoctlGetTermios(int(os.Stdin.Fd()), unix.TCGETS); err != nil {
+		sigs = append(sigs, syscall.SIGINT, syscall.SIGQUIT)
+	}
+	ch := make(chan os.Signal, 8)
+	signal.Notify(ch, sigs...)
+	go func() {
+		for sig := range ch {
+			main.Signal(sig)
+		}
+	}()
+	return func() {
+		signal.Stop(ch)
+		close(ch)
+	}
+}
+
+func forwardSignals(conn *net.UnixConn, p *os.Process) {
+	buf := make([]byte, 4096)
+	for {
+		n, err := conn.Read(buf)
+		if err != nil || n == 0 {
+			return
+		}
+		var sig Signal
+		if json.Unmarshal(buf[:n], &sig) == nil && sig.Signal > 0 {
+			p.Signal(syscall.Signal(sig.Signal))
+		}
+	}
+}
+
+func parseRights(oob []byte) ([]int, error) {
+	msgs, err := syscall.ParseSocketControlMessage(oob)
+	if err != nil {
+		return nil, err
+	}
+	var fds []int
+	for _, m := range msgs {
+		rights, err := syscall.ParseUnixRights(&m)
+		if err != nil {
+			return nil, err
+		}
+		fds = append(fds, rights...)
+	}
+	return fds, nil
+}
+
+func command(req *Request, stdio [3]*os.File) (*exec.Cmd, error) {
+	if len(req.Args) == 0 {
+		return nil, errors.New("args must not be empty")
+	}
+	path, err := lookPath(req.Args[0], req.Env)
+	if err != nil {
+		return nil, err
+	}
+	cmd := &exec.Cmd{
+		Path:   path,
+		Args:   req.Args,
+		Env:    append(prootEnv(req.Env), req.Env...),
+		Dir:    req.Cwd,
+		Stdin:  stdio[0],
+		Stdout: stdio[1],
+		Stderr: stdio[2],
+	}
+	return cmd, nil
+}
+
+// prootEnv returns the PROOT_* variables of the agent that are not set in env,
+// e.g. PROOT_TMP_DIR, which is needed when the process starts a nested PRoot.
+func prootEnv(env []string) []string {
+	set := make(map[string]bool)
+	for _, kv := range env {
+		set[strings.SplitN(kv, "=", 2)[0]] = true
+	}
+	var ss []string
+	for _, kv := range os.Environ() {
+		if k := strings.SplitN(kv, "=", 2)[0]; strings.HasPrefix(k, "PROOT_") && !set[k] {
+			ss = append(ss, kv)
+		}
+	}
+	return ss
+}
+
+// lookPath looks up the executable in $PATH of env, rather than the one of the agent.
+func lookPath(file string, env []string) (string, error) {
+	if strings.Contains(file, "/") {
+		return file, nil
+	}
+	path := "/usr/local/sbin:/usr/local/bin:/usr/sbin:/usr/bin:/sbin:/bin"
+	for _, kv := range env {
+		if strings.HasPrefix(kv, "PATH=") {
+			path = kv[len("PATH="):]
+		}
+	}
+	for _, dir := range filepath.SplitList(path) {
+		p := filepath.Join(dir, file)
+		if fi, err := os.Stat(p); err == nil && fi.Mode().IsRegular() && fi.Mode()&0111 != 0 {
+			return p, nil
+		}
+	}
+	return "", errors.Errorf("%s: executable file not found in $PATH", file)
+}
+
+func exitCode(err error) int {
+	if err == nil {
+		return 0
+	}
+	if exitErr, ok := err.(*exec.ExitError); ok {
+		if ws, ok := exitErr.Sys().(syscall.WaitStatus); ok {
+			if ws.Signaled() {
+				return 128 + int(ws.Signal())
+			}
+			return ws.ExitStatus()
+		}
+	}
+	return 255
+}
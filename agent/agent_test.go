@@ -0,0 +1,187 @@
+package agent
+
+import (
+	"encoding/json"
+	"io/ioutil"
+	"net"
+	"os"
+	"path/filepath"
+	"syscall"
+	"testing"
+	"time"
+
+	"github.com/stretchr/testify/require"
+)
+
+func TestServe(t *testing.T) {
+	tmp, err := ioutil.TempDir("", "runrootless-agent-test")
+	require.NoError(t, err)
+	defer os.RemoveAll(tmp)
+	sock := filepath.Join(tmp, "agent.sock")
+
+	served := make(chan int, 1)
+	go func() {
+		code, err := Serve(sock, nil)
+		require.NoError(t, err)
+		served <- code
+	}()
+	waitSocket(t, sock)
+
+	out, err := os.Create(filepath.Join(tmp, "out"))
+	require.NoError(t, err)
+	defer out.Close()
+	req := &Request{
+		Args: []string{"sh", "-c", `echo "$FOO" "$PWD"; exit 3`},
+		Env:  []string{"PATH=/usr/bin:/bin", "FOO=hello"},
+		Cwd:  tmp,
+	}
+	code, err := Run(sock, req, [3]*os.File{os.Stdin, out, os.Stderr})
+	require.NoError(t, err)
+	require.Equal(t, 3, code)
+	b, err := ioutil.ReadFile(out.Name())
+	require.NoError(t, err)
+	require.Equal(t, "hello "+tmp+"\n", string(b))
+
+	// the first request is the main process
+	select {
+	case code := <-served:
+		require.Equal(t, 3, code)
+	case <-time.After(10 * time.Second):
+		t.Fatal("Serve did not return after the main process exited")
+	}
+}
+
+func TestServeMain(t *testing.T) {
+	tmp, err := ioutil.TempDir("", "runrootless-agent-test")
+	require.NoError(t, err)
+	defer os.RemoveAll(tmp)
+	sock := filepath.Join(tmp, "agent.sock")
+	stop := filepath.Join(tmp, "stop")
+
+	// main runs until the stop file appears
+	main := &Request{
+		Args: []string{"sh", "-c", "while [ ! -e " + stop + " ]; do sleep 0.01; done; exit 7"},
+		Env:  []string{"PATH=/usr/bin:/bin"},
+		Cwd:  "/",
+	}
+	served := make(chan int, 1)
+	go func() {
+		code, err := Serve(sock, main)
+		require.NoError(t, err)
+		served <- code
+	}()
+	waitSocket(t, sock)
+
+	// exec while main is running
+	for i := 0; i < 3; i++ {
+		code, err := Run(sock, &Request{Args: []string{"true"}, Env: main.Env, Cwd: "/"}, [3]*os.File{os.Stdin, os.Stdout, os.Stderr})
+		require.NoError(t, err)
+		require.Equal(t, 0, code)
+	}
+
+	// the environment and the working directory default to the ones of main
+	out, err := os.Create(filepath.Join(tmp, "out"))
+	require.NoError(t, err)
+	defer out.Close()
+	req := &Request{Args: []string{"sh", "-c", `echo "$PATH" "$FOO" "$PWD"`}, ExtraEnv: []string{"FOO=hello"}}
+	code, err := Run(sock, req, [3]*os.File{os.Stdin, out, os.Stderr})
+	require.NoError(t, err)
+	require.Equal(t, 0, code)
+	b, err := ioutil.ReadFile(out.Name())
+	require.NoError(t, err)
+	require.Equal(t, "/usr/bin:/bin hello /\n", string(b))
+
+	// a lingering process is killed when main exits
+	lingering := make(chan int, 1)
+	go func() {
+		code, _ := Run(sock, &Request{Args: []string{"sleep", "60"}, Env: main.Env, Cwd: "/"}, [3]*os.File{os.Stdin, os.Stdout, os.Stderr})
+		lingering <- code
+	}()
+	time.Sleep(100 * time.Millisecond)
+	require.NoError(t, ioutil.WriteFile(stop, nil, 0644))
+	select {
+	case code := <-served:
+		require.Equal(t, 7, code)
+	case <-time.After(10 * time.Second):
+		t.Fatal("Serve did not return after the main process exited")
+	}
+	select {
+	case <-lingering:
+	case <-time.After(10 * time.Second):
+		t.Fatal("the lingering process was not killed")
+	}
+}
+
+func TestServeNotFound(t *testing.T) {
+	tmp, err := ioutil.TempDir("", "runrootless-agent-test")
+	require.NoError(t, err)
+	defer os.RemoveAll(tmp)
+	sock := filepath.Join(tmp, "agent.sock")
+	go Serve(sock, nil)
+	waitSocket(t, sock)
+
+	req := &Request{Args: []string{"no-such-executable"}, Env: []string{"PATH=/nonexistent"}, Cwd: "/"}
+	code, err := Run(sock, req, [3]*os.File{os.Stdin, os.Stdout, os.Stderr})
+	require.Error(t, err)
+	require.Equal(t, 127, code)
+}
+
+// TestServeBadRights checks that a request with the wrong number of descriptors is rejected,
+// and that the descriptors are closed.
+func TestServeBadRights(t *testing.T) {
+	tmp, err := ioutil.TempDir("", "runrootless-agent-test")
+	require.NoError(t, err)
+	defer os.RemoveAll(tmp)
+	sock := filepath.Join(tmp, "agent.sock")
+	stop := filepath.Join(tmp, "stop")
+	main := &Request{
+		Args: []string{"sh", "-c", "while [ ! -e " + stop + " ]; do sleep 0.01; done"},
+		Env:  []string{"PATH=/usr/bin:/bin"},
+		Cwd:  "/",
+	}
+	served := make(chan struct{})
+	go func() {
+		Serve(sock, main)
+		close(served)
+	}()
+	defer func() {
+		ioutil.WriteFile(stop, nil, 0644)
+		<-served
+	}()
+	waitSocket(t, sock)
+
+	fdsBefore, err := ioutil.ReadDir("/proc/self/fd")
+	require.NoError(t, err)
+	for _, fds := range [][]int{{0, 1}, {0, 1, 2, 2}, {0, 1, 2, 0, 1, 2, 0, 1}} {
+		conn, err := net.DialUnix("unixpacket", nil, &net.UnixAddr{Name: sock, Net: "unixpacket"})
+		require.NoError(t, err)
+		_, _, err = conn.WriteMsgUnix([]byte(`{"args": ["true"]}`), syscall.UnixRights(fds...), nil)
+		require.NoError(t, err)
+		buf := make([]byte, maxMessageSize)
+		n, err := conn.Read(buf)
+		require.NoError(t, err)
+		conn.Close()
+		var res Response
+		require.NoError(t, json.Unmarshal(buf[:n], &res))
+		require.Equal(t, 255, res.ExitCode, "%d fds", len(fds))
+		require.Equal(t, "expected 3 file descriptors", res.Error)
+	}
+	fdsAfter, err := ioutil.ReadDir("/proc/self/fd")
+	require.NoError(t, err)
+	require.Equal(t, len(fdsBefore), len(fdsAfter))
+
+	// the agent keeps serving
+	code, err := Run(sock, &Request{Args: []string{"true"}}, [3]*os.File{os.Stdin, os.Stdout, os.Stderr})
+	require.NoError(t, err)
+	require.Equal(t, 0, code)
+}
+
+func waitSocket(t *testing.T, sock string) {
+	for i := 0; i < 1000; i++ {
+		if _, err := os.Stat(sock); err == nil {
+			return
+		}
+		time.Sleep(10 * time.Millisecond)
+	}
+	t.Fatalf("%s did not appear", sock)
+}
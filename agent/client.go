@@ -0,0 +1,57 @@
+package agent
+
+import (
+	"encoding/json"
+	"net"
+	"os"
+	"os/signal"
+	"syscall"
+
+	"github.com/pkg/errors"
+)
+
+// Run spawns req via the agent listening on socketPath, with the given stdio.
+// Signals received by runrootless are forwarded to the process.
+// Run returns the exit code of the process.
+func Run(socketPath string, req *Request, stdio [3]*os.File) (int, error) {
+	conn, err := net.DialUnix("unixpacket", nil, &net.UnixAddr{Name: socketPath, Net: "unixpacket"})
+	if err != nil {
+		return 0, err
+	}
+	defer conn.Close()
+	data, err := json.Marshal(req)
+	if err != nil {
+		return 0, err
+	}
+	if len(data) > maxMessageSize {
+		return 0, errors.Errorf("request too large: %d bytes", len(data))
+	}
+	rights := syscall.UnixRights(int(stdio[0].Fd()), int(stdio[1].Fd()), int(stdio[2].Fd()))
+	if _, _, err := conn.WriteMsgUnix(data, rights, nil); err != nil {
+		return 0, err
+	}
+
+	sigs := make(chan os.Signal, 8)
+	signal.Notify(sigs, syscall.SIGINT, syscall.SIGTERM, syscall.SIGHUP, syscall.SIGQUIT, syscall.SIGUSR1, syscall.SIGUSR2)
+	defer signal.Stop(sigs)
+	go func() {
+		for sig := range sigs {
+			data, _ := json.Marshal(Signal{Signal: int(sig.(syscall.Signal))})
+			conn.Write(data)
+		}
+	}()
+
+	buf := make([]byte, 4096)
+	n, err := conn.Read(buf)
+	if err != nil {
+		return 0, errors.Wrap(err, "agent")
+	}
+	var res Response
+	if err := json.Unmarshal(buf[:n], &res); err != nil {
+		return 0, err
+	}
+	if res.Error != "" {
+		return res.ExitCode, errors.New(res.Error)
+	}
+	return res.ExitCode, nil
+}
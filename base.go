@@ -0,0 +1,47 @@
+package main
+
+import (
+	"fmt"
+	"text/tabwriter"
+
+	"github.com/rootless-containers/runrootless/base"
+	"github.com/urfave/cli"
+)
+
+var baseCommand = cli.Command{
+	Name:  "base",
+	Usage: "manage the base rootfs shared by the containers of the same image (see 'prepare --base')",
+	Subcommands: []cli.Command{
+		{
+			Name:   "ls",
+			Usage:  "list the bases",
+			Action: baseList,
+		},
+		{
+			Name:   "prune",
+			Usage:  "remove the views of the deleted containers, and the bases without views",
+			Action: basePrune,
+		},
+	},
+}
+
+func baseList(context *cli.Context) error {
+	infos, err := base.List()
+	if err != nil {
+		return err
+	}
+	w := tabwriter.NewWriter(context.App.Writer, 12, 1, 3, ' ', 0)
+	fmt.Fprint(w, "DIGEST\tVIEWS\tROOTFS\n")
+	for _, info := range infos {
+		fmt.Fprintf(w, "%s\t%d\t%s\n", info.Digest, info.Views, info.RootFS)
+	}
+	return w.Flush()
+}
+
+func basePrune(context *cli.Context) error {
+	removed, err := base.Prune()
+	for _, s := range removed {
+		fmt.Fprintln(context.App.Writer, s)
+	}
+	return err
+}
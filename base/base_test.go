@@ -0,0 +1,345 @@
+package base
+
+import (
+	"encoding/json"
+	"fmt"
+	"io/ioutil"
+	"os"
+	"os/exec"
+	"path/filepath"
+	"strings"
+	"syscall"
+	"testing"
+	"time"
+	"unsafe"
+
+	"github.com/pkg/errors"
+	"github.com/rootless-containers/runrootless/ownership"
+	"github.com/stretchr/testify/require"
+	"golang.org/x/sys/unix"
+)
+
+const testDigest = "sha256:0123456789abcdef"
+
+// setUp creates a fake $HOME with a base of n files, a tenth of them in /etc.
+// The returned function restores the environment.
+func setUp(t testing.TB, n int) (string, func()) {
+	home, err := ioutil.TempDir("", "runrootless-test")
+	require.NoError(t, err)
+	oldHome := os.Getenv("HOME")
+	os.Setenv("HOME", home)
+	require.NoError(t, Import(testDigest, func(rootfs string) error {
+		for _, d := range []string{"etc", "usr/lib"} {
+			if err := os.MkdirAll(filepath.Join(rootfs, d), 0755); err != nil {
+				return err
+			}
+		}
+		data := make([]byte, 8192)
+		for i := 0; i < n; i++ {
+			dir := "usr/lib"
+			if i%10 == 0 {
+				dir = "etc"
+			}
+			if err := ioutil.WriteFile(filepath.Join(rootfs, dir, fmt.Sprintf("f%d", i)), data, 0644); err != nil {
+				return err
+			}
+		}
+		if err := os.Symlink("usr/lib", filepath.Join(rootfs, "lib")); err != nil {
+			return err
+		}
+		return os.Chmod(filepath.Join(rootfs, "usr"), 0555)
+	}))
+	return home, func() {
+		os.Setenv("HOME", oldHome)
+		removeAll(home)
+	}
+}
+
+// age makes the views and the bases older than viewGracePeriod.
+func age(t *testing.T) {
+	old := time.Now().Add(-2 * viewGracePeriod)
+	for _, dir := range []string{viewsDir(), filepath.Join(Dir(), "bases", "sha256")} {
+		fis, err := ioutil.ReadDir(dir)
+		require.NoError(t, err)
+		for _, fi := range fis {
+			require.NoError(t, os.Chtimes(filepath.Join(dir, fi.Name()), old, old))
+		}
+	}
+}
+
+// TestHelperViews is executed by inViews.
+func TestHelperViews(t *testing.T) {
+	action := os.Getenv("RUNROOTLESS_TEST_VIEWS_ACTION")
+	if action == "" {
+		return
+	}
+	var views []*View
+	require.NoError(t, json.Unmarshal([]byte(os.Getenv("RUNROOTLESS_TEST_VIEWS")), &views))
+	for _, v := range views {
+		if v.Overlay != nil {
+			require.NoError(t, unix.Mount("overlay", v.RootFS, "overlay", 0, strings.Join(v.Overlay.Options(), ",")))
+		}
+	}
+	switch action {
+	case "read":
+		for _, v := range views {
+			require.NoError(t, filepath.Walk(v.RootFS, func(p string, fi os.FileInfo, err error) error {
+				if err != nil || !fi.Mode().IsRegular() {
+					return err
+				}
+				_, err = ioutil.ReadFile(p)
+				return err
+			}))
+		}
+	case "modify":
+		rootfs := views[0].RootFS
+		for _, f := range []string{"etc/f0", "usr/lib/f1"} {
+			p := filepath.Join(rootfs, f)
+			require.NoError(t, ioutil.WriteFile(p, []byte("modified"), 0644))
+			require.NoError(t, os.Chmod(p, 0600))
+			// the emulated chown
+			if err := ownership.Set(p, ownership.Owner{UID: 1000, GID: 1000}); errors.Cause(err) != unix.ENOTSUP {
+				require.NoError(t, err)
+			}
+			data, err := ioutil.ReadFile(p)
+			require.NoError(t, err)
+			require.Equal(t, "modified", string(data))
+		}
+		require.NoError(t, os.Remove(filepath.Join(rootfs, "usr", "lib", "f2")))
+		require.NoError(t, ioutil.WriteFile(filepath.Join(rootfs, "etc", "new"), nil, 0644))
+	default:
+		t.Fatalf("unknown action %q", action)
+	}
+}
+
+// inViews executes action of TestHelperViews on the views in a new user namespace and mount namespace,
+// where the overlay views are mounted as by the runtime.
+func inViews(t testing.TB, action string, views []*View) {
+	data, err := json.Marshal(views)
+	require.NoError(t, err)
+	cmd := exec.Command(os.Args[0], "-test.run", "^TestHelperViews$")
+	cmd.Env = append(os.Environ(), "RUNROOTLESS_TEST_VIEWS_ACTION="+action, "RUNROOTLESS_TEST_VIEWS="+string(data))
+	cmd.SysProcAttr = &syscall.SysProcAttr{
+		Cloneflags:  syscall.CLONE_NEWUSER | syscall.CLONE_NEWNS,
+		UidMappings: []syscall.SysProcIDMap{{ContainerID: 0, HostID: os.Getuid(), Size: 1}},
+		GidMappings: []syscall.SysProcIDMap{{ContainerID: 0, HostID: os.Getgid(), Size: 1}},
+	}
+	out, err := cmd.CombinedOutput()
+	require.NoError(t, err, string(out))
+}
+
+func TestView(t *testing.T) {
+	home, tearDown := setUp(t, 10)
+	defer tearDown()
+	container := filepath.Join(home, "runc", "foo")
+
+	v, err := CreateView(testDigest, container)
+	if errors.Cause(err) == ErrNoReflink {
+		// no view that shares the inodes with the base is left behind
+		fis, rerr := ioutil.ReadDir(viewsDir())
+		require.NoError(t, rerr)
+		require.Empty(t, fis)
+		t.Skip(err)
+	}
+	require.NoError(t, err)
+	baseRootFS, err := RootFS(testDigest)
+	require.NoError(t, err)
+	if v.Overlay != nil {
+		t.Log("the filesystem does not support reflinks, the view is an overlay")
+		require.Equal(t, baseRootFS, v.Contents())
+		fi, err := os.Lstat(v.Overlay.Upper)
+		require.NoError(t, err)
+		require.Equal(t, os.FileMode(0755), fi.Mode().Perm())
+	}
+	fi, err := os.Lstat(filepath.Join(v.Contents(), "usr"))
+	require.NoError(t, err)
+	require.Equal(t, os.FileMode(0555), fi.Mode().Perm())
+	link, err := os.Readlink(filepath.Join(v.Contents(), "lib"))
+	require.NoError(t, err)
+	require.Equal(t, "usr/lib", link)
+
+	// the files are private to the view, even when modified in place
+	inViews(t, "modify", []*View{v})
+	for _, f := range []string{"etc/f0", "usr/lib/f1", "usr/lib/f2"} {
+		p := filepath.Join(baseRootFS, f)
+		fi, err := os.Stat(p)
+		require.NoError(t, err)
+		require.Equal(t, int64(8192), fi.Size())
+		require.Equal(t, os.FileMode(0644), fi.Mode().Perm())
+		_, ok, err := ownership.Get(p)
+		require.NoError(t, err)
+		require.False(t, ok)
+	}
+	_, err = os.Lstat(filepath.Join(baseRootFS, "etc", "new"))
+	require.True(t, os.IsNotExist(err))
+	if v.Overlay != nil {
+		// copied up on the first write
+		data, err := ioutil.ReadFile(filepath.Join(v.Overlay.Upper, "etc", "f0"))
+		require.NoError(t, err)
+		require.Equal(t, "modified", string(data))
+	}
+
+	infos, err := List()
+	require.NoError(t, err)
+	require.Equal(t, []Info{{Digest: testDigest, RootFS: baseRootFS, Views: 1}}, infos)
+
+	// the container is running
+	require.NoError(t, os.MkdirAll(container, 0755))
+	_, err = CreateView(testDigest, container)
+	require.Error(t, err)
+	age(t)
+	removed, err := Prune()
+	require.NoError(t, err)
+	require.Empty(t, removed)
+
+	// the container is deleted
+	require.NoError(t, os.RemoveAll(container))
+	removed, err = Prune()
+	require.NoError(t, err)
+	require.Len(t, removed, 2)
+	infos, err = List()
+	require.NoError(t, err)
+	require.Empty(t, infos)
+}
+
+// TestPruneGracePeriod checks that a view whose container has not been created yet,
+// and the base it refers to, are kept until the grace period expires.
+func TestPruneGracePeriod(t *testing.T) {
+	home, tearDown := setUp(t, 1)
+	defer tearDown()
+	dir := filepath.Join(viewsDir(), "foo-0123456789ab")
+	require.NoError(t, os.MkdirAll(filepath.Join(dir, "rootfs"), 0700))
+	require.NoError(t, ioutil.WriteFile(filepath.Join(dir, "base"), []byte(testDigest), 0644))
+	require.NoError(t, ioutil.WriteFile(filepath.Join(dir, "container"), []byte(filepath.Join(home, "runc", "foo")), 0644))
+
+	removed, err := Prune()
+	require.NoError(t, err)
+	require.Empty(t, removed)
+
+	age(t)
+	removed, err = Prune()
+	require.NoError(t, err)
+	require.Equal(t, dir, removed[0])
+	require.Len(t, removed, 2)
+}
+
+// benchmarkViews creates replicas views of a base of 2000 8KiB files, and reports the disk usage
+// of the views in addition to the base, and the page cache used for reading every file through every view.
+// It is skipped if the filesystem does not support reflinks and the kernel does not support overlayfs
+// in user namespaces.
+func benchmarkViews(b *testing.B, replicas int) {
+	home, tearDown := setUp(b, 2000)
+	defer tearDown()
+	baseRootFS, err := RootFS(testDigest)
+	require.NoError(b, err)
+	baseBytes := diskUsage(b, baseRootFS, nil)
+	var views []*View
+	b.ResetTimer()
+	for i := 0; i < b.N; i++ {
+		views = views[:0]
+		for j := 0; j < replicas; j++ {
+			v, err := CreateView(testDigest, filepath.Join(home, "runc", fmt.Sprintf("c%d", j)))
+			if errors.Cause(err) == ErrNoReflink {
+				b.Skip(err)
+			}
+			if err != nil {
+				b.Fatal(err)
+			}
+			views = append(views, v)
+		}
+	}
+	b.StopTimer()
+	seen := make(map[uint64]bool)
+	diskUsage(b, baseRootFS, seen)
+	viewBytes := diskUsage(b, viewsDir(), seen)
+
+	syscall.Sync()
+	dropPageCache(b, Dir())
+	inViews(b, "read", views)
+	cacheBytes := pageCache(b, Dir())
+
+	kind := "reflink"
+	if views[0].Overlay != nil {
+		kind = "overlay"
+	}
+	b.ReportMetric(float64(viewBytes)/1024, "views-disk-KiB")
+	b.ReportMetric(float64(cacheBytes)/1024, "page-cache-KiB")
+	b.Logf("%d %s replicas: base %d KiB, views %d KiB (a full copy per replica: %d KiB), page cache %d KiB",
+		replicas, kind, baseBytes/1024, viewBytes/1024, int64(replicas)*baseBytes/1024, cacheBytes/1024)
+}
+
+// diskUsage returns the disk usage of the inodes under root that are not in seen.
+func diskUsage(b *testing.B, root string, seen map[uint64]bool) int64 {
+	if seen == nil {
+		seen = make(map[uint64]bool)
+	}
+	var total int64
+	require.NoError(b, filepath.Walk(root, func(p string, fi os.FileInfo, err error) error {
+		if err != nil {
+			return err
+		}
+		st := fi.Sys().(*syscall.Stat_t)
+		if !seen[st.Ino] {
+			seen[st.Ino] = true
+			total += st.Blocks * 512
+		}
+		return nil
+	}))
+	return total
+}
+
+// walkFiles calls fn for each regular file under root with a non-zero size.
+func walkFiles(b *testing.B, root string, fn func(f *os.File, size int64)) {
+	require.NoError(b, filepath.Walk(root, func(p string, fi os.FileInfo, err error) error {
+		if err != nil || !fi.Mode().IsRegular() || fi.Size() == 0 {
+			return err
+		}
+		f, err := os.Open(p)
+		if err != nil {
+			return err
+		}
+		defer f.Close()
+		fn(f, fi.Size())
+		return nil
+	}))
+}
+
+// dropPageCache evicts the clean pages of the files under root from the page cache.
+func dropPageCache(b *testing.B, root string) {
+	walkFiles(b, root, func(f *os.File, size int64) {
+		require.NoError(b, unix.Fadvise(int(f.Fd()), 0, 0, unix.FADV_DONTNEED))
+	})
+}
+
+// pageCache returns the size of the pages of the files under root that are in the page cache.
+func pageCache(b *testing.B, root string) int64 {
+	pageSize := int64(os.Getpagesize())
+	var total int64
+	walkFiles(b, root, func(f *os.File, size int64) {
+		mem, err := unix.Mmap(int(f.Fd()), 0, int(size), unix.PROT_READ, unix.MAP_SHARED)
+		require.NoError(b, err)
+		defer unix.Munmap(mem)
+		vec := make([]byte, (size+pageSize-1)/pageSize)
+		// x/sys/unix does not provide mincore(2)
+		_, _, errno := unix.Syscall(unix.SYS_MINCORE, uintptr(unsafe.Pointer(&mem[0])), uintptr(size), uintptr(unsafe.Pointer(&vec[0])))
+		if errno != 0 {
+			b.Fatal(errno)
+		}
+		for _, v := range vec {
+			total += int64(v&1) * pageSize
+		}
+	})
+	return total
+}
+
+func BenchmarkViews1(b *testing.B) {
+	benchmarkViews(b, 1)
+}
+
+func BenchmarkViews10(b *testing.B) {
+	benchmarkViews(b, 10)
+}
+
+func BenchmarkViews100(b *testing.B) {
+	benchmarkViews(b, 100)
+}
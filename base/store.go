@@ -0,0 +1,195 @@
+// Package base manages the read-only base rootfs of each image, shared by the containers
+// through cheap writable views.
+//
+//	~/.runrootless/bases/sha256/<hex>/rootfs  the base rootfs of the image with the manifest digest
+//	~/.runrootless/views/<name>/rootfs        the writable view of a container
+//	~/.runrootless/views/<name>/{upper,work}  the directories of the overlay, if rootfs is an overlay of the base
+//	~/.runrootless/views/<name>/base          the digest of the base
+//	~/.runrootless/views/<name>/container     the runc state directory of the container
+package base
+
+import (
+	"io/ioutil"
+	"os"
+	"path/filepath"
+	"strings"
+	"time"
+
+	"github.com/pkg/errors"
+	"golang.org/x/sys/unix"
+)
+
+// Annotation is the annotation of a bundle that uses a base rootfs instead of its own.
+// The value is the manifest digest of the image.
+const Annotation = "runrootless.rootfs.base"
+
+// Dir returns the directory of runrootless in $HOME, which contains the PRoot binary, the bases, the views and the pools.
+func Dir() string {
+	// we can't use os/user.Current in a static binary.
+	// moby/moby#29478
+	return filepath.Join(os.Getenv("HOME"), ".runrootless")
+}
+
+func basesDir() string {
+	return filepath.Join(Dir(), "bases")
+}
+
+func viewsDir() string {
+	return filepath.Join(Dir(), "views")
+}
+
+// RootFS returns the path of the base rootfs for the digest.
+func RootFS(digest string) (string, error) {
+	parts := strings.SplitN(digest, ":", 2)
+	if len(parts) != 2 || parts[0] == "" || parts[1] == "" || strings.ContainsAny(digest, "/.") {
+		return "", errors.Errorf("invalid digest: %q", digest)
+	}
+	return filepath.Join(basesDir(), parts[0], parts[1], "rootfs"), nil
+}
+
+// Import creates the base rootfs for the digest by calling unpack, unless it already exists.
+// The base appears atomically.
+func Import(digest string, unpack func(rootfs string) error) error {
+	rootfs, err := RootFS(digest)
+	if err != nil {
+		return err
+	}
+	dir := filepath.Dir(rootfs)
+	if _, err := os.Stat(rootfs); err == nil {
+		return nil
+	}
+	if err := os.MkdirAll(filepath.Dir(dir), 0700); err != nil {
+		return err
+	}
+	tmp, err := ioutil.TempDir(filepath.Dir(dir), ".tmp-")
+	if err != nil {
+		return err
+	}
+	if err := unpack(filepath.Join(tmp, "rootfs")); err != nil {
+		removeAll(tmp)
+		return err
+	}
+	if err := os.Rename(tmp, dir); err != nil {
+		removeAll(tmp)
+		// lost the race against a concurrent import
+		if _, err := os.Stat(rootfs); err == nil {
+			return nil
+		}
+		return err
+	}
+	return nil
+}
+
+// Info describes a base.
+type Info struct {
+	Digest string `json:"digest"`
+	RootFS string `json:"rootfs"`
+	// Views is the number of the views of the base.
+	Views int `json:"views"`
+}
+
+// List returns the bases.
+func List() ([]Info, error) {
+	views, err := listViews()
+	if err != nil {
+		return nil, err
+	}
+	refs := make(map[string]int)
+	for _, v := range views {
+		refs[v.Base]++
+	}
+	algos, err := ioutil.ReadDir(basesDir())
+	if os.IsNotExist(err) {
+		return nil, nil
+	}
+	if err != nil {
+		return nil, err
+	}
+	var infos []Info
+	for _, algo := range algos {
+		fis, err := ioutil.ReadDir(filepath.Join(basesDir(), algo.Name()))
+		if err != nil {
+			return nil, err
+		}
+		for _, fi := range fis {
+			if strings.HasPrefix(fi.Name(), ".") {
+				continue
+			}
+			digest := algo.Name() + ":" + fi.Name()
+			rootfs, _ := RootFS(digest)
+			infos = append(infos, Info{Digest: digest, RootFS: rootfs, Views: refs[digest]})
+		}
+	}
+	return infos, nil
+}
+
+// Prune removes the views of the containers that no longer exist, and then the bases without views.
+// Views and bases younger than viewGracePeriod are kept, as they may be about to be used.
+// It returns the removed paths.
+func Prune() ([]string, error) {
+	unlock, err := lock(unix.LOCK_EX)
+	if err != nil {
+		return nil, err
+	}
+	defer unlock()
+	views, err := listViews()
+	if err != nil {
+		return nil, err
+	}
+	var removed []string
+	for _, v := range views {
+		if v.alive() {
+			continue
+		}
+		if err := removeAll(v.dir); err != nil {
+			return removed, err
+		}
+		removed = append(removed, v.dir)
+	}
+	infos, err := List()
+	if err != nil {
+		return removed, err
+	}
+	for _, info := range infos {
+		if info.Views > 0 {
+			continue
+		}
+		dir := filepath.Dir(info.RootFS)
+		if fi, err := os.Stat(dir); err == nil && time.Since(fi.ModTime()) < viewGracePeriod {
+			continue
+		}
+		if err := removeAll(dir); err != nil {
+			return removed, err
+		}
+		removed = append(removed, dir)
+	}
+	return removed, nil
+}
+
+// lock takes the lock of the bases and the views, and returns the function to release it.
+// Prune takes it exclusively, so that it does not remove a base while a view is being cloned from it.
+func lock(how int) (func(), error) {
+	if err := os.MkdirAll(Dir(), 0700); err != nil {
+		return nil, err
+	}
+	f, err := os.OpenFile(filepath.Join(Dir(), "bases.lock"), os.O_RDWR|os.O_CREATE, 0600)
+	if err != nil {
+		return nil, err
+	}
+	if err := unix.Flock(int(f.Fd()), how); err != nil {
+		f.Close()
+		return nil, err
+	}
+	return func() { f.Close() }, nil
+}
+
+// removeAll removes p, including the directories without the write permission.
+func removeAll(p string) error {
+	filepath.Walk(p, func(path string, fi os.FileInfo, err error) error {
+		if err == nil && fi.IsDir() && fi.Mode().Perm()&0700 != 0700 {
+			os.Chmod(path, fi.Mode().Perm()|0700)
+		}
+		return nil
+	})
+	return os.RemoveAll(p)
+}
@@ -0,0 +1,290 @@
+package base
+
+import (
+	"crypto/sha256"
+	"encoding/hex"
+	"fmt"
+	"io/ioutil"
+	"os"
+	"path/filepath"
+	"strings"
+	"syscall"
+	"time"
+
+	"github.com/pkg/errors"
+	"github.com/rootless-containers/runrootless/ownership"
+	"golang.org/x/sys/unix"
+)
+
+// ficlone is FICLONE from <linux/fs.h>.
+const ficlone = 0x40049409
+
+// viewGracePeriod is how long a view is kept regardless of its container,
+// as the view is created before runc creates the state directory of the container.
+const viewGracePeriod = time.Hour
+
+// ErrNoReflink is returned by CreateView if the filesystem does not support reflinks,
+// and the kernel does not support overlayfs in user namespaces.
+// Sharing the inodes with the base instead, e.g. by hardlinks, would let a container modify
+// the base and the other views through chmod, the emulated chown, or a write in place.
+var ErrNoReflink = errors.New("the filesystem does not support reflinks (FICLONE), and the kernel does not support overlayfs in user namespaces (Linux 5.11), one of which is required for the views of a base")
+
+// View is a writable view of a base, created for a container.
+type View struct {
+	// Dir is the directory of the view.
+	Dir string
+	// RootFS is the rootfs of the container.
+	RootFS string
+	// Overlay is the overlay of the base to be mounted on RootFS by the runtime, in the user namespace
+	// of the container. If it is nil, the files of RootFS are reflinked to the base.
+	Overlay *Overlay
+}
+
+// Contents returns the directory that holds the files of the view before the container is started.
+func (v *View) Contents() string {
+	if v.Overlay != nil {
+		return v.Overlay.Lower
+	}
+	return v.RootFS
+}
+
+// Overlay is an overlayfs with the base as the lower directory.
+type Overlay struct {
+	Lower string
+	Upper string
+	Work  string
+}
+
+// Options returns the mount options of the overlay.
+// userxattr makes overlayfs store its own xattrs in user.overlay.* instead of trusted.overlay.*,
+// as required in a user namespace.
+func (o *Overlay) Options() []string {
+	return []string{"lowerdir=" + o.Lower, "upperdir=" + o.Upper, "workdir=" + o.Work, "userxattr"}
+}
+
+// viewInfo describes a view on disk.
+type viewInfo struct {
+	dir       string
+	modTime   time.Time
+	Base      string
+	Container string
+}
+
+func (v *viewInfo) alive() bool {
+	if time.Since(v.modTime) < viewGracePeriod {
+		return true
+	}
+	if v.Container == "" {
+		return false
+	}
+	_, err := os.Stat(v.Container)
+	return err == nil
+}
+
+func listViews() ([]viewInfo, error) {
+	fis, err := ioutil.ReadDir(viewsDir())
+	if os.IsNotExist(err) {
+		return nil, nil
+	}
+	if err != nil {
+		return nil, err
+	}
+	var views []viewInfo
+	for _, fi := range fis {
+		v := viewInfo{dir: filepath.Join(viewsDir(), fi.Name()), modTime: fi.ModTime()}
+		// a view without these files is being created, or has been partially removed
+		b, _ := ioutil.ReadFile(filepath.Join(v.dir, "base"))
+		c, _ := ioutil.ReadFile(filepath.Join(v.dir, "container"))
+		v.Base, v.Container = string(b), string(c)
+		views = append(views, v)
+	}
+	return views, nil
+}
+
+// CreateView creates a writable view of the base for the container.
+// container is the runc state directory of the container, which is used for pruning the view
+// after the container is deleted. An existing view for a deleted container is recreated.
+// The files of the view are reflinked to the base. If the filesystem does not support reflinks,
+// the view is an overlay of the base instead, which is mounted when the container is created;
+// ErrNoReflink is returned if the kernel does not support overlayfs in user namespaces either.
+func CreateView(digest, container string) (*View, error) {
+	unlock, err := lock(unix.LOCK_SH)
+	if err != nil {
+		return nil, err
+	}
+	defer unlock()
+	baseRootFS, err := RootFS(digest)
+	if err != nil {
+		return nil, err
+	}
+	if _, err := os.Stat(baseRootFS); err != nil {
+		return nil, errors.Wrapf(err, "base %s is not available", digest)
+	}
+	if _, err := os.Stat(container); err == nil {
+		return nil, errors.Errorf("container %s already exists", container)
+	}
+	h := sha256.Sum256([]byte(container))
+	dir := filepath.Join(viewsDir(), filepath.Base(container)+"-"+hex.EncodeToString(h[:])[:12])
+	if err := removeAll(dir); err != nil {
+		return nil, err
+	}
+	if err := os.MkdirAll(dir, 0700); err != nil {
+		return nil, err
+	}
+	// the view refers to the base while being cloned
+	if err := ioutil.WriteFile(filepath.Join(dir, "base"), []byte(digest), 0644); err != nil {
+		removeAll(dir)
+		return nil, err
+	}
+	if err := ioutil.WriteFile(filepath.Join(dir, "container"), []byte(container), 0644); err != nil {
+		removeAll(dir)
+		return nil, err
+	}
+	v := &View{Dir: dir, RootFS: filepath.Join(dir, "rootfs")}
+	err = clone(baseRootFS, v.RootFS)
+	if errors.Cause(err) == ErrNoReflink && overlaySupported() {
+		v.Overlay, err = createOverlay(baseRootFS, v)
+	}
+	if err != nil {
+		removeAll(dir)
+		return nil, err
+	}
+	return v, nil
+}
+
+// overlaySupported returns whether the kernel supports overlayfs in user namespaces,
+// with the userxattr option (Linux 5.11).
+func overlaySupported() bool {
+	b, err := ioutil.ReadFile("/proc/sys/kernel/osrelease")
+	if err != nil {
+		return false
+	}
+	var major, minor int
+	if _, err := fmt.Sscanf(string(b), "%d.%d", &major, &minor); err != nil {
+		return false
+	}
+	return major > 5 || major == 5 && minor >= 11
+}
+
+// createOverlay replaces the partial clone of lower in v with the directories of an overlay.
+// The root directory of the overlay is the upper directory, which gets the mode and the ownership of lower.
+func createOverlay(lower string, v *View) (*Overlay, error) {
+	if strings.ContainsAny(lower, ",:") {
+		return nil, errors.Errorf("the path of the base %s cannot be a lower directory of overlayfs", lower)
+	}
+	o := &Overlay{Lower: lower, Upper: filepath.Join(v.Dir, "upper"), Work: filepath.Join(v.Dir, "work")}
+	if err := removeAll(v.RootFS); err != nil {
+		return nil, err
+	}
+	for _, d := range []string{v.RootFS, o.Upper, o.Work} {
+		if err := os.Mkdir(d, 0700); err != nil {
+			return nil, err
+		}
+	}
+	fi, err := os.Stat(lower)
+	if err != nil {
+		return nil, err
+	}
+	if err := copyOwnership(lower, o.Upper); err != nil {
+		return nil, err
+	}
+	return o, os.Chmod(o.Upper, fi.Mode())
+}
+
+// clone creates dst as a copy-on-write clone of src, by reflinking the regular files.
+func clone(src, dst string) error {
+	type dirMode struct {
+		path string
+		fi   os.FileInfo
+	}
+	var dirs []dirMode
+	err := filepath.Walk(src, func(p string, fi os.FileInfo, err error) error {
+		if err != nil {
+			return err
+		}
+		rel, err := filepath.Rel(src, p)
+		if err != nil {
+			return err
+		}
+		target := filepath.Join(dst, rel)
+		switch {
+		case fi.IsDir():
+			if err := os.Mkdir(target, 0700); err != nil {
+				return err
+			}
+			dirs = append(dirs, dirMode{target, fi})
+			return copyOwnership(p, target)
+		case fi.Mode()&os.ModeSymlink != 0:
+			link, err := os.Readlink(p)
+			if err != nil {
+				return err
+			}
+			return os.Symlink(link, target)
+		case fi.Mode().IsRegular():
+			err := reflinkFile(p, target, fi)
+			if errno, ok := errors.Cause(err).(syscall.Errno); ok && (errno == unix.EOPNOTSUPP || errno == unix.EXDEV || errno == unix.EINVAL || errno == unix.ENOTTY) {
+				return errors.Wrapf(ErrNoReflink, "%s: %v", dst, errno)
+			}
+			return err
+		case fi.Mode()&os.ModeNamedPipe != 0:
+			// user.* xattrs are not allowed on fifos, so there is no ownership to copy
+			return unix.Mkfifo(target, uint32(fi.Mode().Perm()))
+		default:
+			// sockets are not meaningful in a fresh container
+			return nil
+		}
+	})
+	if err != nil {
+		return err
+	}
+	for i := len(dirs) - 1; i >= 0; i-- {
+		d := dirs[i]
+		if err := os.Chmod(d.path, d.fi.Mode()); err != nil {
+			return err
+		}
+		if err := os.Chtimes(d.path, d.fi.ModTime(), d.fi.ModTime()); err != nil {
+			return err
+		}
+	}
+	return nil
+}
+
+// reflinkFile clones src to dst with FICLONE, along with the mode, the times and the emulated ownership.
+func reflinkFile(src, dst string, fi os.FileInfo) error {
+	in, err := os.Open(src)
+	if err != nil {
+		return err
+	}
+	defer in.Close()
+	out, err := os.OpenFile(dst, os.O_WRONLY|os.O_CREATE|os.O_EXCL, 0600)
+	if err != nil {
+		return err
+	}
+	_, _, errno := syscall.Syscall(syscall.SYS_IOCTL, out.Fd(), ficlone, in.Fd())
+	if errno != 0 {
+		err = errno
+	}
+	if cerr := out.Close(); err == nil {
+		err = cerr
+	}
+	if err != nil {
+		os.Remove(dst)
+		return err
+	}
+	// The xattr is set before the mode, as it requires write permission on the inode.
+	if err := copyOwnership(src, dst); err != nil {
+		return err
+	}
+	if err := os.Chmod(dst, fi.Mode()); err != nil {
+		return err
+	}
+	return os.Chtimes(dst, fi.ModTime(), fi.ModTime())
+}
+
+func copyOwnership(src, dst string) error {
+	o, ok, err := ownership.Get(src)
+	if err != nil || !ok {
+		return err
+	}
+	return ownership.Set(dst, o)
+}
@@ -0,0 +1,103 @@
+package bundle
+
+import (
+	"debug/elf"
+	"fmt"
+	"os"
+	"strconv"
+
+	"github.com/opencontainers/runtime-spec/specs-go"
+	"github.com/pkg/errors"
+	"github.com/rootless-containers/runrootless/agent"
+)
+
+// AgentMode selects whether the process of the container is run via the runrootless agent.
+type AgentMode string
+
+const (
+	// AgentNone runs the process of the container under PRoot directly.
+	AgentNone AgentMode = ""
+	// AgentPool parks the container: the agent starts under PRoot and waits for a request,
+	// which becomes the main process of the container.
+	// The process in config.json is not started.
+	AgentPool AgentMode = "pool"
+	// AgentExec runs the process in config.json as the main process of the agent,
+	// which also serves 'runrootless exec' for the container under the same tracer.
+	AgentExec AgentMode = "exec"
+
+	// agentMount is the path of the runrootless binary in the container.
+	agentMount = "/dev/proot/runrootless"
+)
+
+// AgentModeFromEnv returns AgentExec if RUNROOTLESS_EXEC_AGENT is set, otherwise AgentNone.
+func AgentModeFromEnv() AgentMode {
+	if b, _ := strconv.ParseBool(os.Getenv("RUNROOTLESS_EXEC_AGENT")); b {
+		return AgentExec
+	}
+	return AgentNone
+}
+
+// agentBinary returns the path of the runrootless binary.
+// It is a variable so that the tests can replace the test binary, which is not static.
+var agentBinary = os.Executable
+
+// checkStatic returns an error if bin needs an ELF interpreter (the dynamic loader),
+// as it is executed in the rootfs of the container, which may not have the same libc.
+func checkStatic(bin string) error {
+	f, err := elf.Open(bin)
+	if err != nil {
+		return err
+	}
+	defer f.Close()
+	for _, prog := range f.Progs {
+		if prog.Type == elf.PT_INTERP {
+			return errors.Errorf("%s is dynamically linked, and cannot be executed in the container as the agent. build it with CGO_ENABLED=0", bin)
+		}
+	}
+	return nil
+}
+
+// agentDep returns the cache key dependency for the agent mode.
+func agentDep(mode AgentMode) (string, error) {
+	if mode == AgentNone {
+		return "", nil
+	}
+	bin, err := agentBinary()
+	if err != nil {
+		return "", err
+	}
+	st, err := os.Stat(bin)
+	if err != nil {
+		return "", err
+	}
+	return fmt.Sprintf("agent=%s binary=%s size=%d mtime=%d", mode, bin, st.Size(), st.ModTime().UnixNano()), nil
+}
+
+// injectAgent replaces the process of spec with the agent.
+// The agent listens on agent.ContainerSocket, in the PRoot tmpfs.
+func injectAgent(spec *specs.Spec, mode AgentMode) error {
+	bin, err := agentBinary()
+	if err != nil {
+		return err
+	}
+	if err := checkStatic(bin); err != nil {
+		return err
+	}
+	spec.Mounts = append(spec.Mounts, specs.Mount{
+		Destination: agentMount,
+		Type:        "bind",
+		Source:      bin,
+		Options:     []string{"bind", "ro"},
+	})
+	args := []string{agentMount, "agent", agent.ContainerSocket}
+	switch mode {
+	case AgentPool:
+		spec.Process.Terminal = false
+		spec.Process.Args = args
+	case AgentExec:
+		spec.Process.Args = append(append(args, "--"), spec.Process.Args...)
+	default:
+		return errors.Errorf("unknown agent mode: %q", mode)
+	}
+	return nil
+}
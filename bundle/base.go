@@ -0,0 +1,51 @@
+package bundle
+
+import (
+	"bytes"
+	"encoding/json"
+
+	"github.com/opencontainers/runtime-spec/specs-go"
+	"github.com/rootless-containers/runrootless/base"
+)
+
+// baseView creates the writable view of the base rootfs for container, if config uses a base.
+func baseView(config []byte, container string) (*base.View, error) {
+	if container == "" || !bytes.Contains(config, []byte(base.Annotation)) {
+		return nil, nil
+	}
+	var spec struct {
+		Annotations map[string]string `json:"annotations"`
+	}
+	if err := json.Unmarshal(config, &spec); err != nil {
+		return nil, err
+	}
+	digest := spec.Annotations[base.Annotation]
+	if digest == "" {
+		return nil, nil
+	}
+	return base.CreateView(digest, container)
+}
+
+// viewContents returns the directory to read the rootfs of v from while transforming the bundle,
+// or "" if v is nil.
+func viewContents(v *base.View) string {
+	if v == nil {
+		return ""
+	}
+	return v.Contents()
+}
+
+// mountView makes the runtime mount the overlay of v on the rootfs before the other mounts,
+// if v is an overlay of the base.
+func mountView(spec *specs.Spec, v *base.View) {
+	if v == nil || v.Overlay == nil {
+		return
+	}
+	spec.Root.Path = v.RootFS
+	spec.Mounts = append([]specs.Mount{{
+		Destination: "/",
+		Type:        "overlay",
+		Source:      "overlay",
+		Options:     v.Overlay.Options(),
+	}}, spec.Mounts...)
+}
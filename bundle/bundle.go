@@ -9,15 +9,37 @@ import (
 	"github.com/opencontainers/runtime-spec/specs-go"
 )
 
-func Transform(newBundle, oldBundle string) error {
-	spec, err := readSpec(oldBundle)
+// Transform writes a rootless variant of oldBundle into a content-addressed
+// directory under cacheDir, and returns the path of that directory.
+// The result is reused as long as config.json, the PRoot binary and the
+// relevant environment variables are unchanged.
+// container is the runc state directory of the container to be created.
+// It is used for bundles that use a base rootfs, which get a writable view per container;
+// the bundle is then written into the directory of the view instead of cacheDir.
+// agent selects whether the process is run via the runrootless agent.
+func Transform(cacheDir, oldBundle, container string, agent AgentMode) (string, error) {
+	in, err := loadInput(oldBundle, container, agent)
 	if err != nil {
-		return err
+		return "", err
 	}
-	if err := transformSpec(spec, oldBundle); err != nil {
-		return err
+	if in.view != nil {
+		// The bundle of a view is written into the view, so that it is
+		// removed along with the view instead of accumulating in cacheDir.
+		cacheDir = in.view.Dir
+	}
+	newBundle := filepath.Join(cacheDir, in.key)
+	if cacheHit(newBundle) {
+		return newBundle, nil
+	}
+	var spec specs.Spec
+	if err := json.Unmarshal(in.config, &spec); err != nil {
+		return "", err
+	}
+	files, err := transformSpec(&spec, in, newBundle)
+	if err != nil {
+		return "", err
 	}
-	return writeSpec(newBundle, spec)
+	return newBundle, writeBundleAtomic(cacheDir, newBundle, &spec, files)
 }
 
 func readSpec(bundle string) (*specs.Spec, error) {
@@ -42,3 +64,50 @@ func writeSpec(bundle string, spec *specs.Spec) error {
 	f := filepath.Join(bundle, "config.json")
 	return ioutil.WriteFile(f, data, 0666)
 }
+
+// writeBundleAtomic writes spec and files into a private temporary directory
+// under cacheDir and renames it to bundle, so that concurrent invocations
+// never observe a partially written bundle.
+func writeBundleAtomic(cacheDir, bundle string, spec *specs.Spec, files map[string][]byte) error {
+	if err := os.MkdirAll(cacheDir, 0755); err != nil {
+		return err
+	}
+	tmp, err := ioutil.TempDir(cacheDir, tmpPrefix)
+	if err != nil {
+		return err
+	}
+	if err := os.Chmod(tmp, 0755); err != nil {
+		os.RemoveAll(tmp)
+		return err
+	}
+	if err := writeFiles(tmp, files); err != nil {
+		os.RemoveAll(tmp)
+		return err
+	}
+	if err := writeSpec(tmp, spec); err != nil {
+		os.RemoveAll(tmp)
+		return err
+	}
+	if err := os.Rename(tmp, bundle); err != nil {
+		os.RemoveAll(tmp)
+		// lost the race against a concurrent invocation with the same key
+		if cacheHit(bundle) {
+			return nil
+		}
+		return err
+	}
+	return nil
+}
+
+func writeFiles(bundle string, files map[string][]byte) error {
+	for name, data := range files {
+		f := filepath.Join(bundle, name)
+		if err := os.MkdirAll(filepath.Dir(f), 0755); err != nil {
+			return err
+		}
+		if err := ioutil.WriteFile(f, data, 0755); err != nil {
+			return err
+		}
+	}
+	return nil
+}
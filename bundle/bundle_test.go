@@ -0,0 +1,237 @@
+package bundle
+
+import (
+	"bytes"
+	"debug/elf"
+	"encoding/binary"
+	"io/ioutil"
+	"os"
+	"path/filepath"
+	"strings"
+	"testing"
+
+	"github.com/pkg/errors"
+	"github.com/rootless-containers/runrootless/base"
+	"github.com/stretchr/testify/require"
+)
+
+const testConfig = `{
+	"ociVersion": "1.0.0",
+	"process": {"args": ["sh"], "env": ["PATH=/bin"], "cwd": "/"},
+	"root": {"path": "rootfs"},
+	"linux": {"namespaces": [{"type": "pid"}, {"type": "mount"}]}
+}`
+
+// setUp creates a fake $HOME with a PRoot binary, and an old bundle.
+// The returned function restores the environment.
+func setUp(t testing.TB) (string, func()) {
+	dir, err := ioutil.TempDir("", "runrootless-test")
+	require.NoError(t, err)
+	home := filepath.Join(dir, "home")
+	require.NoError(t, os.MkdirAll(filepath.Join(home, ".runrootless"), 0755))
+	require.NoError(t, ioutil.WriteFile(filepath.Join(home, ".runrootless", "runrootless-proot"), []byte("proot"), 0755))
+	oldBundle := filepath.Join(dir, "bundle")
+	require.NoError(t, os.MkdirAll(filepath.Join(oldBundle, "rootfs"), 0755))
+	require.NoError(t, ioutil.WriteFile(filepath.Join(oldBundle, "config.json"), []byte(testConfig), 0644))
+	oldHome, oldSeccomp := os.Getenv("HOME"), os.Getenv("RUNROOTLESS_SECCOMP")
+	os.Setenv("HOME", home)
+	os.Unsetenv("RUNROOTLESS_SECCOMP")
+	return oldBundle, func() {
+		os.Setenv("HOME", oldHome)
+		os.Setenv("RUNROOTLESS_SECCOMP", oldSeccomp)
+		os.RemoveAll(dir)
+	}
+}
+
+func TestTransformCache(t *testing.T) {
+	oldBundle, tearDown := setUp(t)
+	defer tearDown()
+	cacheDir := filepath.Join(oldBundle, "runrootless")
+
+	first, err := Transform(cacheDir, oldBundle, "", AgentNone)
+	require.NoError(t, err)
+	spec, err := readSpec(first)
+	require.NoError(t, err)
+	require.Equal(t, filepath.Join(oldBundle, "rootfs"), spec.Root.Path)
+	require.Equal(t, []string{"/dev/proot/proot", "-0", "sh"}, spec.Process.Args)
+
+	second, err := Transform(cacheDir, oldBundle, "", AgentNone)
+	require.NoError(t, err)
+	require.Equal(t, first, second)
+
+	os.Setenv("RUNROOTLESS_SECCOMP", "1")
+	seccomp, err := Transform(cacheDir, oldBundle, "", AgentNone)
+	require.NoError(t, err)
+	require.NotEqual(t, first, seccomp)
+	os.Unsetenv("RUNROOTLESS_SECCOMP")
+
+	require.NoError(t, ioutil.WriteFile(filepath.Join(oldBundle, "config.json"), []byte(testConfig+"\n"), 0644))
+	modified, err := Transform(cacheDir, oldBundle, "", AgentNone)
+	require.NoError(t, err)
+	require.NotEqual(t, first, modified)
+
+	removed, err := GC(cacheDir, oldBundle, false)
+	require.NoError(t, err)
+	require.Len(t, removed, 2)
+	require.True(t, cacheHit(modified))
+
+	removed, err = GC(cacheDir, oldBundle, true)
+	require.NoError(t, err)
+	require.Equal(t, []string{modified}, removed)
+}
+
+// TestTransformBaseView checks the bundle of a container with a view of a base,
+// whose rootfs is read for the selective mode before the overlay, if any, is mounted.
+func TestTransformBaseView(t *testing.T) {
+	oldBundle, tearDown := setUp(t)
+	defer tearDown()
+	digest := "sha256:0123456789abcdef"
+	require.NoError(t, base.Import(digest, func(rootfs string) error {
+		if err := os.MkdirAll(filepath.Join(rootfs, "bin"), 0755); err != nil {
+			return err
+		}
+		for _, f := range []string{"bin/sh", "bin/dpkg"} {
+			if err := ioutil.WriteFile(filepath.Join(rootfs, f), nil, 0755); err != nil {
+				return err
+			}
+		}
+		return nil
+	}))
+	baseRootFS, err := base.RootFS(digest)
+	require.NoError(t, err)
+	config := strings.Replace(testConfig, `"root"`, `"annotations": {
+		"`+base.Annotation+`": "`+digest+`",
+		"`+AnnotationPRoot+`": "selective",
+		"`+AnnotationPRootExecutables+`": "/bin/dpkg"
+	},
+	"root"`, 1)
+	require.NoError(t, ioutil.WriteFile(filepath.Join(oldBundle, "config.json"), []byte(config), 0644))
+
+	newBundle, err := Transform(filepath.Join(oldBundle, "runrootless"), oldBundle, filepath.Join(oldBundle, "state", "foo"), AgentNone)
+	if errors.Cause(err) == base.ErrNoReflink {
+		t.Skip(err)
+	}
+	require.NoError(t, err)
+	viewDir := filepath.Dir(newBundle)
+	require.Equal(t, filepath.Join(base.Dir(), "views"), filepath.Dir(viewDir))
+	spec, err := readSpec(newBundle)
+	require.NoError(t, err)
+	require.Equal(t, filepath.Join(viewDir, "rootfs"), spec.Root.Path)
+	if _, err := os.Stat(filepath.Join(viewDir, "upper")); err == nil {
+		require.Equal(t, "/", spec.Mounts[0].Destination)
+		require.Equal(t, "overlay", spec.Mounts[0].Type)
+		require.Contains(t, spec.Mounts[0].Options, "lowerdir="+baseRootFS)
+	}
+	_, err = os.Stat(filepath.Join(newBundle, shimDir, "dpkg"))
+	require.NoError(t, err)
+}
+
+// writeELF writes the header of an x86-64 ELF executable to path,
+// with a PT_INTERP program header if interp is true.
+func writeELF(t *testing.T, path string, interp bool) {
+	h := elf.Header64{
+		Type:    uint16(elf.ET_EXEC),
+		Machine: uint16(elf.EM_X86_64),
+		Version: uint32(elf.EV_CURRENT),
+		Ehsize:  uint16(binary.Size(elf.Header64{})),
+	}
+	copy(h.Ident[:], elf.ELFMAG)
+	h.Ident[elf.EI_CLASS] = byte(elf.ELFCLASS64)
+	h.Ident[elf.EI_DATA] = byte(elf.ELFDATA2LSB)
+	h.Ident[elf.EI_VERSION] = byte(elf.EV_CURRENT)
+	var progs []elf.Prog64
+	if interp {
+		progs = append(progs, elf.Prog64{Type: uint32(elf.PT_INTERP)})
+		h.Phoff = uint64(h.Ehsize)
+		h.Phentsize = uint16(binary.Size(elf.Prog64{}))
+		h.Phnum = 1
+	}
+	var buf bytes.Buffer
+	require.NoError(t, binary.Write(&buf, binary.LittleEndian, h))
+	require.NoError(t, binary.Write(&buf, binary.LittleEndian, progs))
+	require.NoError(t, ioutil.WriteFile(path, buf.Bytes(), 0755))
+}
+
+// setUpAgentBinary replaces the agent binary with a fake static executable.
+// The returned function restores it.
+func setUpAgentBinary(t *testing.T, dir string) (string, func()) {
+	bin := filepath.Join(dir, "runrootless")
+	writeELF(t, bin, false)
+	agentBinary = func() (string, error) { return bin, nil }
+	return bin, func() { agentBinary = os.Executable }
+}
+
+func TestTransformAgent(t *testing.T) {
+	oldBundle, tearDown := setUp(t)
+	defer tearDown()
+	cacheDir := filepath.Join(oldBundle, "runrootless")
+	self, restore := setUpAgentBinary(t, filepath.Dir(oldBundle))
+	defer restore()
+
+	plain, err := Transform(cacheDir, oldBundle, "", AgentNone)
+	require.NoError(t, err)
+	pooled, err := Transform(cacheDir, oldBundle, "", AgentPool)
+	require.NoError(t, err)
+	require.NotEqual(t, plain, pooled)
+	spec, err := readSpec(pooled)
+	require.NoError(t, err)
+	require.Equal(t, []string{"/dev/proot/proot", "-0", "/dev/proot/runrootless", "agent", "/dev/proot/agent.sock"}, spec.Process.Args)
+	require.False(t, spec.Process.Terminal)
+	var found bool
+	for _, m := range spec.Mounts {
+		if m.Destination == "/dev/proot/runrootless" {
+			require.Equal(t, self, m.Source)
+			found = true
+		}
+	}
+	require.True(t, found)
+
+	execAgent, err := Transform(cacheDir, oldBundle, "", AgentExec)
+	require.NoError(t, err)
+	spec, err = readSpec(execAgent)
+	require.NoError(t, err)
+	require.Equal(t, []string{"/dev/proot/proot", "-0", "/dev/proot/runrootless", "agent", "/dev/proot/agent.sock", "--", "sh"}, spec.Process.Args)
+
+	// every variant is current
+	removed, err := GC(cacheDir, oldBundle, false)
+	require.NoError(t, err)
+	require.Empty(t, removed)
+	key, err := Key(oldBundle, AgentPool)
+	require.NoError(t, err)
+	require.Equal(t, filepath.Join(cacheDir, key), pooled)
+
+	// a dynamically linked binary would need the loader of the host in the container
+	writeELF(t, self, true)
+	_, err = Transform(cacheDir, oldBundle, "", AgentExec)
+	require.Error(t, err)
+	require.Contains(t, err.Error(), "CGO_ENABLED=0")
+}
+
+func benchmarkTransform(b *testing.B, warm bool) {
+	oldBundle, tearDown := setUp(b)
+	defer tearDown()
+	cacheDir := filepath.Join(oldBundle, "runrootless")
+	if warm {
+		_, err := Transform(cacheDir, oldBundle, "", AgentNone)
+		require.NoError(b, err)
+	}
+	b.ResetTimer()
+	for i := 0; i < b.N; i++ {
+		if !warm {
+			b.StopTimer()
+			require.NoError(b, os.RemoveAll(cacheDir))
+			b.StartTimer()
+		}
+		if _, err := Transform(cacheDir, oldBundle, "", AgentNone); err != nil {
+			b.Fatal(err)
+		}
+	}
+}
+
+func BenchmarkTransformCold(b *testing.B) {
+	benchmarkTransform(b, false)
+}
+
+func BenchmarkTransformWarm(b *testing.B) {
+	benchmarkTransform(b, true)
+}
@@ -0,0 +1,156 @@
+package bundle
+
+import (
+	"crypto/sha256"
+	"encoding/hex"
+	"fmt"
+	"io/ioutil"
+	"os"
+	"path/filepath"
+	"strings"
+	"syscall"
+	"time"
+
+	"github.com/pkg/errors"
+	"github.com/rootless-containers/runrootless/base"
+)
+
+const (
+	// cacheVersion is mixed into every cache key.
+	// Bump it whenever transformSpec produces a different output for the same input.
+	cacheVersion = "1"
+	// tmpPrefix is the prefix of the directories that are being written.
+	tmpPrefix = ".tmp-"
+	// tmpGracePeriod is how long GC leaves a temporary directory alone,
+	// as it may still be written by a running invocation.
+	tmpGracePeriod = time.Hour
+)
+
+// cacheKey returns the content address of the bundle transformed from
+// config, which was read from oldBundle.
+// rootfsDeps are the parts of the rootfs that the transformation depends on.
+func cacheKey(config []byte, oldBundle, proot string, rootfsDeps []string) (string, error) {
+	st, err := os.Stat(proot)
+	if err != nil {
+		return "", err
+	}
+	var ino uint64
+	if sys, ok := st.Sys().(*syscall.Stat_t); ok {
+		ino = sys.Ino
+	}
+	h := sha256.New()
+	fmt.Fprintf(h, "version=%s\n", cacheVersion)
+	fmt.Fprintf(h, "bundle=%s\n", oldBundle)
+	fmt.Fprintf(h, "proot=%s size=%d mtime=%d ino=%d\n", proot, st.Size(), st.ModTime().UnixNano(), ino)
+	fmt.Fprintf(h, "seccomp=%v\n", seccompEnabled())
+	// specconv.ToRootless maps the effective uid and gid in the user namespace
+	fmt.Fprintf(h, "euid=%d egid=%d\n", os.Geteuid(), os.Getegid())
+	for _, d := range rootfsDeps {
+		fmt.Fprintf(h, "rootfs=%s\n", d)
+	}
+	h.Write(config)
+	return hex.EncodeToString(h.Sum(nil)), nil
+}
+
+func cacheHit(bundle string) bool {
+	_, err := os.Stat(filepath.Join(bundle, "config.json"))
+	return err == nil
+}
+
+// Key returns the cache key that Transform currently uses for oldBundle without a container.
+// It changes whenever the transformed bundle would, e.g. when config.json is modified.
+func Key(oldBundle string, agent AgentMode) (string, error) {
+	in, err := loadInput(oldBundle, "", agent)
+	if err != nil {
+		return "", err
+	}
+	return in.key, nil
+}
+
+// GC removes the entries under cacheDir except the ones that Transform would
+// currently return for oldBundle. If all is true, every entry is removed.
+// GC returns the removed paths.
+func GC(cacheDir, oldBundle string, all bool) ([]string, error) {
+	keep := make(map[string]bool)
+	if !all {
+		for _, mode := range []AgentMode{AgentNone, AgentPool, AgentExec} {
+			key, err := Key(oldBundle, mode)
+			if err != nil {
+				return nil, errors.Wrap(err, "cannot compute the current cache key (use --all to remove everything)")
+			}
+			keep[key] = true
+		}
+	}
+	fis, err := ioutil.ReadDir(cacheDir)
+	if err != nil {
+		if os.IsNotExist(err) {
+			return nil, nil
+		}
+		return nil, err
+	}
+	var removed []string
+	for _, fi := range fis {
+		name := fi.Name()
+		if keep[name] {
+			continue
+		}
+		if strings.HasPrefix(name, tmpPrefix) && !all && time.Since(fi.ModTime()) < tmpGracePeriod {
+			continue
+		}
+		p := filepath.Join(cacheDir, name)
+		if err := os.RemoveAll(p); err != nil {
+			return removed, err
+		}
+		removed = append(removed, p)
+	}
+	return removed, nil
+}
+
+// input is everything the transformed bundle depends on.
+type input struct {
+	bundle string
+	config []byte
+	proot  string
+	// view is the writable view of the base rootfs for the container, if the bundle uses a base
+	view  *base.View
+	agent AgentMode
+	key   string
+}
+
+// loadInput loads the input for transforming oldBundle.
+// For a bundle that uses a base rootfs, a writable view is created for container,
+// unless container is empty.
+func loadInput(oldBundle, container string, agent AgentMode) (*input, error) {
+	oldBundle, err := filepath.Abs(oldBundle)
+	if err != nil {
+		return nil, err
+	}
+	config, err := ioutil.ReadFile(filepath.Join(oldBundle, "config.json"))
+	if err != nil {
+		return nil, err
+	}
+	proot, err := prootPath()
+	if err != nil {
+		return nil, err
+	}
+	view, err := baseView(config, container)
+	if err != nil {
+		return nil, err
+	}
+	deps, err := selectiveDeps(config, oldBundle, viewContents(view))
+	if err != nil {
+		return nil, err
+	}
+	dep, err := agentDep(agent)
+	if err != nil {
+		return nil, err
+	}
+	if dep != "" {
+		deps = append(deps, dep)
+	}
+	key, err := cacheKey(config, oldBundle, proot, deps)
+	if err != nil {
+		return nil, err
+	}
+	return &input{bundle: oldBundle, config: config, proot: proot, view: view, agent: agent, key: key}, nil
+}
@@ -0,0 +1,167 @@
+package bundle
+
+import (
+	"bytes"
+	"encoding/json"
+	"fmt"
+	"os"
+	"path"
+	"path/filepath"
+	"strings"
+
+	"github.com/opencontainers/runtime-spec/specs-go"
+	"github.com/pkg/errors"
+	"github.com/rootless-containers/runrootless/fsutil"
+)
+
+const (
+	// AnnotationPRoot selects which processes run under PRoot.
+	// "all" (default): the whole process tree.
+	// "selective": only the executables listed in AnnotationPRootExecutables,
+	// and their descendants. Other processes run natively in the user namespace.
+	AnnotationPRoot = "runrootless.proot"
+	// AnnotationPRootExecutables is a comma-separated list of the absolute paths
+	// of the executables that need root emulation, e.g. "/usr/bin/apt-get,/usr/bin/dpkg".
+	// Paths that do not exist in the rootfs are ignored.
+	// The base names must be unique, as the executables are intercepted by name via $PATH.
+	AnnotationPRootExecutables = "runrootless.proot.executables"
+
+	prootModeAll       = "all"
+	prootModeSelective = "selective"
+
+	// shimDir is the directory in the new bundle that contains the shims of the executables.
+	shimDir = "shims"
+	// shimMount is the directory in the container where shimDir is bind-mounted.
+	// It is prepended to $PATH, so that the executables are intercepted when looked up by name.
+	// The executables themselves are left in place, so that package managers can replace them.
+	shimMount = "/dev/proot/shims"
+	// envUnderPRoot is set by the shims for PRoot, so that nested shims don't start another PRoot.
+	envUnderPRoot = "RUNROOTLESS_PROOT"
+	// defaultPath is $PATH when the process does not set it, as in 'runc spec'.
+	defaultPath = "/usr/local/sbin:/usr/local/bin:/usr/sbin:/usr/bin:/sbin:/bin"
+)
+
+// executable is an executable that runs under PRoot in the selective mode.
+type executable struct {
+	// path is the path listed in AnnotationPRootExecutables
+	path string
+	// resolved is path with the symlinks resolved within the rootfs.
+	resolved string
+}
+
+// shimPath returns the path of the shim of e in the container.
+func (e *executable) shimPath() string {
+	return path.Join(shimMount, path.Base(e.path))
+}
+
+// selectiveExecutables returns the executables to be run under PRoot.
+// ok is false unless spec is configured for the selective mode.
+func selectiveExecutables(spec *specs.Spec) (exes []executable, ok bool, err error) {
+	switch mode := spec.Annotations[AnnotationPRoot]; mode {
+	case "", prootModeAll:
+		return nil, false, nil
+	case prootModeSelective:
+	default:
+		return nil, false, errors.Errorf("unknown %s annotation: %q", AnnotationPRoot, mode)
+	}
+	for _, p := range strings.Split(spec.Annotations[AnnotationPRootExecutables], ",") {
+		p = strings.TrimSpace(p)
+		if p == "" {
+			continue
+		}
+		if !path.IsAbs(p) {
+			return nil, false, errors.Errorf("%s must be absolute paths: %q", AnnotationPRootExecutables, p)
+		}
+		resolved, err := fsutil.ResolveInRoot(spec.Root.Path, p)
+		if os.IsNotExist(errors.Cause(err)) {
+			continue
+		}
+		if err != nil {
+			return nil, false, err
+		}
+		for _, e := range exes {
+			if path.Base(e.path) == path.Base(p) {
+				return nil, false, errors.Errorf("%s must have unique base names: %q and %q", AnnotationPRootExecutables, e.path, p)
+			}
+		}
+		exes = append(exes, executable{path: p, resolved: resolved})
+	}
+	return exes, true, nil
+}
+
+// selectiveDeps returns the parts of the rootfs that the output of transformSpec depends on.
+// It is cheap for bundles that are not configured for the selective mode.
+func selectiveDeps(config []byte, oldBundle, rootfs string) ([]string, error) {
+	if !bytes.Contains(config, []byte(AnnotationPRootExecutables)) {
+		return nil, nil
+	}
+	var spec specs.Spec
+	if err := json.Unmarshal(config, &spec); err != nil {
+		return nil, err
+	}
+	if spec.Root == nil {
+		return nil, errors.New("root is not specified")
+	}
+	toAbsoluteRootFS(&spec, oldBundle, rootfs)
+	exes, _, err := selectiveExecutables(&spec)
+	if err != nil {
+		return nil, err
+	}
+	var deps []string
+	for _, e := range exes {
+		deps = append(deps, e.path+"="+e.resolved)
+	}
+	return deps, nil
+}
+
+// injectSelectivePRoot runs the listed executables under PRoot via shims in a directory prepended to $PATH,
+// and returns the shims to be written into the new bundle.
+// The processes that execute a listed executable by its absolute path are not intercepted,
+// unless they run under PRoot already.
+func injectSelectivePRoot(spec *specs.Spec, exes []executable, newBundle string) (map[string][]byte, error) {
+	if len(exes) == 0 {
+		return nil, nil
+	}
+	if _, err := fsutil.ResolveInRoot(spec.Root.Path, "/bin/sh"); err != nil {
+		return nil, errors.Wrap(err, "the selective mode requires /bin/sh in the rootfs")
+	}
+	files := make(map[string][]byte)
+	for _, e := range exes {
+		// The variable is set only for PRoot and its tracees, so that it is not inherited by
+		// the processes that run natively, e.g. the ones started with 'runc exec'.
+		files[filepath.Join(shimDir, path.Base(e.path))] = []byte(fmt.Sprintf(`#!/bin/sh
+if [ -n "$%[1]s" ]; then
+	exec %[2]s "$@"
+fi
+%[1]s=1 exec /dev/proot/proot -0 %[2]s "$@"
+`, envUnderPRoot, e.path))
+	}
+	spec.Mounts = append(spec.Mounts, specs.Mount{
+		Destination: shimMount,
+		Type:        "bind",
+		Source:      filepath.Join(newBundle, shimDir),
+		Options:     []string{"bind", "ro"},
+	})
+	spec.Process.Env = prependPath(spec.Process.Env, shimMount)
+	if len(spec.Process.Args) > 0 {
+		arg0 := spec.Process.Args[0]
+		for _, e := range exes {
+			if arg0 == e.path || (!strings.Contains(arg0, "/") && arg0 == path.Base(e.path)) {
+				spec.Process.Args = append([]string{e.shimPath()}, spec.Process.Args[1:]...)
+				break
+			}
+		}
+	}
+	return files, nil
+}
+
+// prependPath returns env with dir prepended to $PATH.
+func prependPath(env []string, dir string) []string {
+	for i, kv := range env {
+		if strings.HasPrefix(kv, "PATH=") {
+			env[i] = "PATH=" + dir + ":" + strings.TrimPrefix(kv, "PATH=")
+			return env
+		}
+	}
+	return append(env, "PATH="+dir+":"+defaultPath)
+}
@@ -0,0 +1,83 @@
+package bundle
+
+import (
+	"io/ioutil"
+	"os"
+	"path/filepath"
+	"strings"
+	"testing"
+
+	"github.com/opencontainers/runtime-spec/specs-go"
+	"github.com/stretchr/testify/require"
+)
+
+const testSelectiveConfig = `{
+	"ociVersion": "1.0.0",
+	"process": {"args": ["nginx"], "env": ["PATH=/bin"], "cwd": "/"},
+	"root": {"path": "rootfs"},
+	"linux": {"namespaces": [{"type": "pid"}, {"type": "mount"}]},
+	"annotations": {
+		"runrootless.proot": "selective",
+		"runrootless.proot.executables": "/usr/bin/dpkg, /usr/sbin/apt-get, /usr/bin/yum"
+	}
+}`
+
+func TestTransformSelective(t *testing.T) {
+	oldBundle, tearDown := setUp(t)
+	defer tearDown()
+	rootfs := filepath.Join(oldBundle, "rootfs")
+	require.NoError(t, os.MkdirAll(filepath.Join(rootfs, "bin"), 0755))
+	require.NoError(t, os.MkdirAll(filepath.Join(rootfs, "usr", "bin"), 0755))
+	for _, f := range []string{"bin/sh", "bin/busybox", "usr/bin/dpkg"} {
+		require.NoError(t, ioutil.WriteFile(filepath.Join(rootfs, f), nil, 0755))
+	}
+	// symlinks are executed as listed, e.g. an applet of busybox
+	require.NoError(t, os.Symlink("bin", filepath.Join(rootfs, "usr", "sbin")))
+	require.NoError(t, os.Symlink("/bin/busybox", filepath.Join(rootfs, "usr", "bin", "apt-get")))
+	require.NoError(t, ioutil.WriteFile(filepath.Join(oldBundle, "config.json"), []byte(testSelectiveConfig), 0644))
+	cacheDir := filepath.Join(oldBundle, "runrootless")
+
+	newBundle, err := Transform(cacheDir, oldBundle, "", AgentNone)
+	require.NoError(t, err)
+	spec, err := readSpec(newBundle)
+	require.NoError(t, err)
+	require.Equal(t, []string{"nginx"}, spec.Process.Args)
+	require.Equal(t, []string{"PATH=/dev/proot/shims:/bin", "PROOT_TMP_DIR=/dev/proot", "PROOT_NO_SECCOMP=1"}, spec.Process.Env)
+	// the executables are not mount points, so that package managers can replace them
+	require.Equal(t, specs.Mount{Destination: "/dev/proot/shims", Type: "bind", Source: filepath.Join(newBundle, "shims"), Options: []string{"bind", "ro"}},
+		spec.Mounts[len(spec.Mounts)-1])
+	for _, m := range spec.Mounts {
+		require.NotContains(t, []string{"/usr/bin/dpkg", "/usr/sbin/apt-get", "/usr/bin/apt-get", "/bin/busybox"}, m.Destination)
+	}
+	shim, err := ioutil.ReadFile(filepath.Join(newBundle, "shims", "dpkg"))
+	require.NoError(t, err)
+	require.Contains(t, string(shim), "RUNROOTLESS_PROOT=1 exec /dev/proot/proot -0 /usr/bin/dpkg \"$@\"")
+	shim, err = ioutil.ReadFile(filepath.Join(newBundle, "shims", "apt-get"))
+	require.NoError(t, err)
+	require.Contains(t, string(shim), "exec /dev/proot/proot -0 /usr/sbin/apt-get \"$@\"")
+
+	// installing a listed executable invalidates the cache
+	require.NoError(t, ioutil.WriteFile(filepath.Join(rootfs, "usr", "bin", "yum"), nil, 0755))
+	updated, err := Transform(cacheDir, oldBundle, "", AgentNone)
+	require.NoError(t, err)
+	require.NotEqual(t, newBundle, updated)
+
+	// a listed process is started by its shim, which sets RUNROOTLESS_PROOT for PRoot only,
+	// so that the processes started with 'runc exec' are intercepted as well
+	config := strings.Replace(testSelectiveConfig, `"args": ["nginx"], "env": ["PATH=/bin"]`, `"args": ["dpkg", "-i", "foo.deb"], "env": []`, 1)
+	require.NoError(t, ioutil.WriteFile(filepath.Join(oldBundle, "config.json"), []byte(config), 0644))
+	listed, err := Transform(cacheDir, oldBundle, "", AgentNone)
+	require.NoError(t, err)
+	spec, err = readSpec(listed)
+	require.NoError(t, err)
+	require.Equal(t, []string{"/dev/proot/shims/dpkg", "-i", "foo.deb"}, spec.Process.Args)
+	require.Equal(t, []string{"PROOT_TMP_DIR=/dev/proot", "PROOT_NO_SECCOMP=1", "PATH=/dev/proot/shims:" + defaultPath}, spec.Process.Env)
+
+	// the shims are looked up by name
+	config = strings.Replace(testSelectiveConfig, "/usr/bin/yum", "/bin/dpkg", 1)
+	require.NoError(t, ioutil.WriteFile(filepath.Join(rootfs, "bin", "dpkg"), nil, 0755))
+	require.NoError(t, ioutil.WriteFile(filepath.Join(oldBundle, "config.json"), []byte(config), 0644))
+	_, err = Transform(cacheDir, oldBundle, "", AgentNone)
+	require.Error(t, err)
+	require.Contains(t, err.Error(), "unique base names")
+}
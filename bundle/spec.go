@@ -8,25 +8,38 @@ import (
 	"github.com/opencontainers/runc/libcontainer/specconv"
 	"github.com/opencontainers/runtime-spec/specs-go"
 	"github.com/pkg/errors"
+	"github.com/rootless-containers/runrootless/base"
 )
 
-func transformSpec(spec *specs.Spec, oldBundle string) error {
+// transformSpec transforms spec in place, and returns the files to be
+// written into newBundle along with config.json, keyed by the relative path.
+func transformSpec(spec *specs.Spec, in *input, newBundle string) (map[string][]byte, error) {
 	specconv.ToRootless(spec)
-	toAbsoluteRootFS(spec, oldBundle)
-	return injectPRoot(spec)
+	// The rootfs is read by the transformation, so the contents of an overlay view are used until it is mounted.
+	toAbsoluteRootFS(spec, in.bundle, viewContents(in.view))
+	if in.agent != AgentNone {
+		if err := injectAgent(spec, in.agent); err != nil {
+			return nil, err
+		}
+	}
+	files, err := injectPRoot(spec, newBundle, in.proot)
+	if err != nil {
+		return nil, err
+	}
+	mountView(spec, in.view)
+	return files, nil
 }
 
-func toAbsoluteRootFS(spec *specs.Spec, oldBundle string) {
-	if !filepath.IsAbs(spec.Root.Path) {
+// toAbsoluteRootFS makes the rootfs path absolute, or replaces it with rootfs if not empty.
+func toAbsoluteRootFS(spec *specs.Spec, oldBundle, rootfs string) {
+	if rootfs != "" {
+		spec.Root.Path = rootfs
+	} else if !filepath.IsAbs(spec.Root.Path) {
 		spec.Root.Path = filepath.Clean(filepath.Join(oldBundle, spec.Root.Path))
 	}
 }
 
-func injectPRoot(spec *specs.Spec) error {
-	proot, err := prootPath()
-	if err != nil {
-		return err
-	}
+func injectPRoot(spec *specs.Spec, newBundle, proot string) (map[string][]byte, error) {
 	spec.Mounts = append(spec.Mounts,
 		specs.Mount{
 			Destination: "/dev/proot",
@@ -41,20 +54,28 @@ func injectPRoot(spec *specs.Spec) error {
 			Options:     []string{"bind", "ro"},
 		},
 	)
-	spec.Process.Args = append([]string{"/dev/proot/proot", "-0"}, spec.Process.Args...)
 	spec.Process.Env = append(spec.Process.Env, "PROOT_TMP_DIR=/dev/proot")
-	enableSeccomp, _ := strconv.ParseBool(os.Getenv("RUNROOTLESS_SECCOMP"))
-	if !enableSeccomp {
+	if !seccompEnabled() {
 		spec.Process.Env = append(spec.Process.Env, "PROOT_NO_SECCOMP=1")
 	}
-	return nil
+	exes, selective, err := selectiveExecutables(spec)
+	if err != nil {
+		return nil, err
+	}
+	if selective {
+		return injectSelectivePRoot(spec, exes, newBundle)
+	}
+	spec.Process.Args = append([]string{"/dev/proot/proot", "-0"}, spec.Process.Args...)
+	return nil, nil
+}
+
+func seccompEnabled() bool {
+	b, _ := strconv.ParseBool(os.Getenv("RUNROOTLESS_SECCOMP"))
+	return b
 }
 
 func prootPath() (string, error) {
-	// we can't use os/user.Current in a static binary.
-	// moby/moby#29478
-	home := os.Getenv("HOME")
-	s := filepath.Join(home, ".runrootless", "runrootless-proot")
+	s := filepath.Join(base.Dir(), "runrootless-proot")
 	_, err := os.Stat(s)
 	if os.IsNotExist(err) {
 		return s, errors.Errorf("%s not found. please install runrootless-proot according to README.", s)
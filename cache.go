@@ -0,0 +1,43 @@
+package main
+
+import (
+	"fmt"
+
+	"github.com/rootless-containers/runrootless/bundle"
+	"github.com/urfave/cli"
+)
+
+var cacheCommand = cli.Command{
+	Name:  "cache",
+	Usage: "manage the transformed bundles cached under <bundle>/runrootless",
+	Subcommands: []cli.Command{
+		{
+			Name:  "gc",
+			Usage: "remove stale transformed bundles",
+			Flags: []cli.Flag{
+				cli.StringFlag{
+					Name:  "bundle, b",
+					Value: "",
+					Usage: `path to the root of the bundle directory, defaults to the current directory`,
+				},
+				cli.BoolFlag{
+					Name:  "all",
+					Usage: "remove the transformed bundle for the current config.json as well",
+				},
+			},
+			Action: cacheGC,
+		},
+	},
+}
+
+func cacheGC(context *cli.Context) error {
+	bundleDir, err := resolveBundleDir(context)
+	if err != nil {
+		return err
+	}
+	removed, err := bundle.GC(cacheDir(bundleDir), bundleDir, context.Bool("all"))
+	for _, s := range removed {
+		fmt.Fprintln(context.App.Writer, s)
+	}
+	return err
+}
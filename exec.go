@@ -0,0 +1,64 @@
+package main
+
+import (
+	"os"
+
+	"github.com/rootless-containers/runrootless/agent"
+	"github.com/sirupsen/logrus"
+	"github.com/urfave/cli"
+)
+
+var execCommand = cli.Command{
+	Name:      "exec",
+	Usage:     "execute new process inside the container, under the PRoot tracer of the container",
+	ArgsUsage: `<container-id> <command> [command options]`,
+	Flags:     runcExecFlags(),
+	Action:    execute,
+}
+
+// execFlagsUnsupported are the exec flags that are not supported by the agent.
+// With any of them, exec is redirected to runc, and the process runs without PRoot.
+var execFlagsUnsupported = []string{
+	"console-socket", "user", "additional-gids", "process", "detach", "pid-file",
+	"process-label", "apparmor", "no-new-privs", "cap", "preserve-fds",
+}
+
+// execute spawns the process via the agent of the container, so that it is traced by the
+// existing PRoot session instead of running without PRoot.
+// It falls back to runc if the container was not created with RUNROOTLESS_EXEC_AGENT=1.
+func execute(context *cli.Context) error {
+	id := context.Args().First()
+	if id == "" || context.NArg() < 2 {
+		redirectToRunc()
+	}
+	for _, f := range execFlagsUnsupported {
+		if context.IsSet(f) {
+			logrus.Debugf("exec: --%s is not supported by the agent. redirecting to runc.", f)
+			redirectToRunc()
+		}
+	}
+	state, err := getContainerState(context, id)
+	if err != nil {
+		return err
+	}
+	sock := agent.SocketPath(state.Pid)
+	if _, err := os.Stat(sock); err != nil {
+		logrus.Debugf("exec: no agent in %s (%v). redirecting to runc.", id, err)
+		redirectToRunc()
+	}
+	// The agent defaults the environment and the working directory to the ones of the process
+	// of the container, as the bundle it was created from may have been modified or removed.
+	req := &agent.Request{
+		Args:     context.Args().Tail(),
+		ExtraEnv: context.StringSlice("env"),
+		Cwd:      context.String("cwd"),
+	}
+	code, err := agent.Run(sock, req, [3]*os.File{os.Stdin, os.Stdout, os.Stderr})
+	if err != nil {
+		return err
+	}
+	if code != 0 {
+		return cli.NewExitError("", code)
+	}
+	return nil
+}
@@ -0,0 +1,94 @@
+// Package fsutil provides filesystem helpers for manipulating a rootfs from the host.
+package fsutil
+
+import (
+	"os"
+	"path"
+	"path/filepath"
+	"strings"
+
+	"github.com/pkg/errors"
+)
+
+// ResolveInRoot resolves the symlinks in p as if root were the root directory,
+// and returns the resolved absolute path within root.
+func ResolveInRoot(root, p string) (string, error) {
+	const maxSymlinks = 40
+	resolved := "/"
+	components := strings.Split(p, "/")
+	links := 0
+	for len(components) > 0 {
+		c := components[0]
+		components = components[1:]
+		switch c {
+		case "", ".":
+			continue
+		case "..":
+			resolved = path.Dir(resolved)
+			continue
+		}
+		next := path.Join(resolved, c)
+		fi, err := os.Lstat(filepath.Join(root, next))
+		if err != nil {
+			return "", err
+		}
+		if fi.Mode()&os.ModeSymlink == 0 {
+			resolved = next
+			continue
+		}
+		if links++; links > maxSymlinks {
+			return "", errors.Errorf("too many levels of symbolic links: %s", p)
+		}
+		target, err := os.Readlink(filepath.Join(root, next))
+		if err != nil {
+			return "", err
+		}
+		if path.IsAbs(target) {
+			resolved = "/"
+		}
+		components = append(strings.Split(target, "/"), components...)
+	}
+	return resolved, nil
+}
+
+// MkdirAllInRoot creates the directory p and its parents in root with mode 0755,
+// resolving symlinks within root, and returns the resolved path within root.
+func MkdirAllInRoot(root, p string) (string, error) {
+	resolved := "/"
+	for _, c := range strings.Split(path.Clean("/"+p), "/") {
+		if c == "" {
+			continue
+		}
+		next, err := ResolveInRoot(root, path.Join(resolved, c))
+		if os.IsNotExist(errors.Cause(err)) {
+			next = path.Join(resolved, c)
+			if err := os.Mkdir(filepath.Join(root, next), 0755); err != nil {
+				// e.g. a dangling symlink
+				return "", err
+			}
+		} else if err != nil {
+			return "", err
+		}
+		fi, err := os.Lstat(filepath.Join(root, next))
+		if err != nil {
+			return "", err
+		}
+		if !fi.IsDir() {
+			return "", errors.Errorf("%s: not a directory", path.Join(resolved, c))
+		}
+		resolved = next
+	}
+	return resolved, nil
+}
+
+// SecureJoin returns the host path of p in root. The symlinks in the parent directories
+// of p are resolved within root, and the missing ones are created. The last component is
+// not resolved, so that it can be created or replaced.
+func SecureJoin(root, p string) (string, error) {
+	p = path.Clean("/" + p)
+	parent, err := MkdirAllInRoot(root, path.Dir(p))
+	if err != nil {
+		return "", err
+	}
+	return filepath.Join(root, parent, path.Base(p)), nil
+}
@@ -0,0 +1,59 @@
+package fsutil
+
+import (
+	"io/ioutil"
+	"os"
+	"path/filepath"
+	"testing"
+
+	"github.com/stretchr/testify/require"
+)
+
+func TestResolveInRoot(t *testing.T) {
+	root, err := ioutil.TempDir("", "runrootless-test")
+	require.NoError(t, err)
+	defer os.RemoveAll(root)
+	require.NoError(t, os.MkdirAll(filepath.Join(root, "usr", "lib"), 0755))
+	require.NoError(t, ioutil.WriteFile(filepath.Join(root, "usr", "lib", "f"), nil, 0644))
+	require.NoError(t, os.Symlink("usr/lib", filepath.Join(root, "lib")))
+	require.NoError(t, os.Symlink("/../../lib/f", filepath.Join(root, "usr", "abs")))
+	require.NoError(t, os.Symlink("loop", filepath.Join(root, "loop")))
+
+	for p, expected := range map[string]string{
+		"/usr/lib/f": "/usr/lib/f",
+		"/lib/f":     "/usr/lib/f",
+		"/usr/abs":   "/usr/lib/f",
+		"/../lib/f":  "/usr/lib/f",
+	} {
+		resolved, err := ResolveInRoot(root, p)
+		require.NoError(t, err, p)
+		require.Equal(t, expected, resolved, p)
+	}
+	_, err = ResolveInRoot(root, "/loop")
+	require.Error(t, err)
+	_, err = ResolveInRoot(root, "/nonexistent")
+	require.True(t, os.IsNotExist(err))
+}
+
+func TestSecureJoin(t *testing.T) {
+	root, err := ioutil.TempDir("", "runrootless-test")
+	require.NoError(t, err)
+	defer os.RemoveAll(root)
+	require.NoError(t, os.Mkdir(filepath.Join(root, "usr"), 0755))
+	require.NoError(t, os.Symlink("/usr", filepath.Join(root, "escape")))
+	require.NoError(t, os.Symlink("/nonexistent", filepath.Join(root, "dangling")))
+
+	p, err := SecureJoin(root, "/escape/lib/../lib/f")
+	require.NoError(t, err)
+	require.Equal(t, filepath.Join(root, "usr", "lib", "f"), p)
+	fi, err := os.Lstat(filepath.Join(root, "usr", "lib"))
+	require.NoError(t, err)
+	require.True(t, fi.IsDir())
+
+	p, err = SecureJoin(root, "../../etc/passwd")
+	require.NoError(t, err)
+	require.Equal(t, filepath.Join(root, "etc", "passwd"), p)
+
+	_, err = SecureJoin(root, "/dangling/f")
+	require.Error(t, err)
+}
@@ -0,0 +1,288 @@
+package image
+
+import (
+	"archive/tar"
+	"bytes"
+	"compress/gzip"
+	"crypto/sha256"
+	"encoding/hex"
+	"encoding/json"
+	"fmt"
+	"io/ioutil"
+	"math/rand"
+	"os"
+	"os/exec"
+	"path/filepath"
+	"runtime"
+	"syscall"
+	"testing"
+	"time"
+
+	"github.com/pkg/errors"
+	"github.com/rootless-containers/runrootless/ownership"
+	"github.com/stretchr/testify/require"
+	"golang.org/x/sys/unix"
+)
+
+type entry struct {
+	name     string
+	typeflag byte
+	mode     int64
+	uid, gid int
+	linkname string
+	body     []byte
+}
+
+func writeBlob(t testing.TB, dir string, data []byte, mediaType string) Descriptor {
+	sum := sha256.Sum256(data)
+	hex := hex.EncodeToString(sum[:])
+	require.NoError(t, ioutil.WriteFile(filepath.Join(dir, "blobs", "sha256", hex), data, 0644))
+	return Descriptor{MediaType: mediaType, Digest: "sha256:" + hex, Size: int64(len(data))}
+}
+
+func writeJSONBlob(t testing.TB, dir string, v interface{}, mediaType string) Descriptor {
+	data, err := json.Marshal(v)
+	require.NoError(t, err)
+	return writeBlob(t, dir, data, mediaType)
+}
+
+// writeLayout writes an image named "latest" with the layers into a new layout directory.
+func writeLayout(t testing.TB, layers [][]entry, config *Config) Layout {
+	dir, err := ioutil.TempDir("", "runrootless-test")
+	require.NoError(t, err)
+	require.NoError(t, os.MkdirAll(filepath.Join(dir, "blobs", "sha256"), 0755))
+	var m Manifest
+	m.Config = writeJSONBlob(t, dir, config, "application/vnd.oci.image.config.v1+json")
+	for _, entries := range layers {
+		var buf bytes.Buffer
+		zw := gzip.NewWriter(&buf)
+		tw := tar.NewWriter(zw)
+		for _, e := range entries {
+			hdr := &tar.Header{
+				Name:     e.name,
+				Typeflag: e.typeflag,
+				Mode:     e.mode,
+				Uid:      e.uid,
+				Gid:      e.gid,
+				Linkname: e.linkname,
+				Size:     int64(len(e.body)),
+				ModTime:  time.Unix(1500000000, 0),
+			}
+			require.NoError(t, tw.WriteHeader(hdr))
+			_, err := tw.Write(e.body)
+			require.NoError(t, err)
+		}
+		require.NoError(t, tw.Close())
+		require.NoError(t, zw.Close())
+		m.Layers = append(m.Layers, writeBlob(t, dir, buf.Bytes(), "application/vnd.oci.image.layer.v1.tar+gzip"))
+	}
+	md := writeJSONBlob(t, dir, m, mediaTypeManifest)
+	md.Annotations = map[string]string{annotationRefName: "latest"}
+	idx := map[string]interface{}{"schemaVersion": 2, "manifests": []Descriptor{md}}
+	data, err := json.Marshal(idx)
+	require.NoError(t, err)
+	require.NoError(t, ioutil.WriteFile(filepath.Join(dir, "index.json"), data, 0644))
+	return Layout(dir)
+}
+
+func TestPrepare(t *testing.T) {
+	var config Config
+	config.Config.Entrypoint = []string{"/bin/sh", "-c"}
+	config.Config.Cmd = []string{"echo hello"}
+	config.Config.Env = []string{"PATH=/bin"}
+	layout := writeLayout(t, [][]entry{
+		{
+			{name: "etc/", typeflag: tar.TypeDir, mode: 0755},
+			{name: "etc/passwd", typeflag: tar.TypeReg, mode: 0644, body: []byte("root:x:0:0::/root:/bin/sh\n")},
+			{name: "home/user/", typeflag: tar.TypeDir, mode: 0700, uid: 1000, gid: 1000},
+			{name: "home/user/file", typeflag: tar.TypeReg, mode: 0600, uid: 1000, gid: 1000, body: []byte("x")},
+			{name: "opaque/old", typeflag: tar.TypeReg, mode: 0644},
+			{name: "removed", typeflag: tar.TypeReg, mode: 0644},
+			{name: "escape", typeflag: tar.TypeSymlink, linkname: "/"},
+			{name: "ro/", typeflag: tar.TypeDir, mode: 0555},
+			{name: "ro/file", typeflag: tar.TypeReg, mode: 0444},
+		},
+		{
+			{name: "opaque/new", typeflag: tar.TypeReg, mode: 0644},
+			{name: "opaque/.wh..wh..opq", typeflag: tar.TypeReg},
+			{name: ".wh.removed", typeflag: tar.TypeReg},
+			{name: "escape/etc/shadow", typeflag: tar.TypeReg, mode: 0600},
+			{name: "link", typeflag: tar.TypeLink, linkname: "etc/passwd"},
+			{name: "ro/file", typeflag: tar.TypeReg, mode: 0444, body: []byte("updated")},
+		},
+	}, &config)
+	defer os.RemoveAll(string(layout))
+	bundleDir := filepath.Join(string(layout), "bundle")
+	require.NoError(t, Prepare(bundleDir, layout, PrepareOptions{Ref: "latest", Jobs: 2}))
+	rootfs := filepath.Join(bundleDir, "rootfs")
+
+	for _, p := range []string{"opaque/new", "etc/shadow", "link", "home/user/file"} {
+		_, err := os.Lstat(filepath.Join(rootfs, p))
+		require.NoError(t, err, p)
+	}
+	for _, p := range []string{"opaque/old", "removed"} {
+		_, err := os.Lstat(filepath.Join(rootfs, p))
+		require.True(t, os.IsNotExist(err), p)
+	}
+	data, err := ioutil.ReadFile(filepath.Join(rootfs, "ro", "file"))
+	require.NoError(t, err)
+	require.Equal(t, "updated", string(data))
+	fi, err := os.Lstat(filepath.Join(rootfs, "ro"))
+	require.NoError(t, err)
+	require.Equal(t, os.FileMode(0555), fi.Mode().Perm())
+	o, ok, err := ownership.Get(filepath.Join(rootfs, "home", "user", "file"))
+	if errors.Cause(err) != unix.ENOTSUP {
+		require.NoError(t, err)
+		require.True(t, ok)
+		require.Equal(t, ownership.Owner{UID: 1000, GID: 1000}, o)
+	}
+
+	spec, err := ioutil.ReadFile(filepath.Join(bundleDir, "config.json"))
+	require.NoError(t, err)
+	require.Contains(t, string(spec), `"/bin/sh",`)
+	require.Contains(t, string(spec), `"echo hello"`)
+
+	require.Error(t, Prepare(bundleDir, layout, PrepareOptions{Ref: "latest", Jobs: 2}), "rootfs already exists")
+	require.NoError(t, os.Chmod(filepath.Join(rootfs, "ro"), 0755))
+}
+
+// TestUnpackRedeclaredDir checks that a directory redeclared by an upper layer
+// neither keeps the owner nor the children of the lower one, when the opaque whiteout follows it.
+func TestUnpackRedeclaredDir(t *testing.T) {
+	layout := writeLayout(t, [][]entry{
+		{
+			{name: "owned/", typeflag: tar.TypeDir, mode: 0755, uid: 1000, gid: 1000},
+			{name: "opaque/", typeflag: tar.TypeDir, mode: 0755},
+			{name: "opaque/sub/", typeflag: tar.TypeDir, mode: 0755},
+			{name: "opaque/sub/old", typeflag: tar.TypeReg, mode: 0644},
+			{name: "opaque/sub/dir/old", typeflag: tar.TypeReg, mode: 0644},
+		},
+		{
+			{name: "owned/", typeflag: tar.TypeDir, mode: 0755},
+			{name: "opaque/sub/", typeflag: tar.TypeDir, mode: 0755},
+			{name: "opaque/sub/dir/", typeflag: tar.TypeDir, mode: 0755},
+			{name: "opaque/sub/new", typeflag: tar.TypeReg, mode: 0644, body: []byte("new")},
+			{name: "opaque/.wh..wh..opq", typeflag: tar.TypeReg},
+		},
+	}, &Config{})
+	defer os.RemoveAll(string(layout))
+	m, _, err := layout.Resolve("")
+	require.NoError(t, err)
+	for _, jobs := range []int{1, 4} {
+		rootfs, err := ioutil.TempDir(string(layout), "rootfs")
+		require.NoError(t, err)
+		require.NoError(t, layout.Unpack(rootfs, m, jobs))
+
+		_, ok, err := ownership.Get(filepath.Join(rootfs, "owned"))
+		require.NoError(t, err)
+		require.False(t, ok, "jobs=%d", jobs)
+		for _, p := range []string{"opaque/sub/old", "opaque/sub/dir/old"} {
+			_, err := os.Lstat(filepath.Join(rootfs, p))
+			require.True(t, os.IsNotExist(err), "jobs=%d %s", jobs, p)
+		}
+		data, err := ioutil.ReadFile(filepath.Join(rootfs, "opaque", "sub", "new"))
+		require.NoError(t, err)
+		require.Equal(t, "new", string(data))
+	}
+}
+
+// TestPrepareUnprivileged unpacks read-only entries with emulated owners as a non-root user,
+// for which setting a user.* xattr requires write permission on the inode.
+// As root, the test re-executes itself as nobody.
+func TestPrepareUnprivileged(t *testing.T) {
+	if os.Geteuid() == 0 && os.Getenv("RUNROOTLESS_TEST_UNPRIVILEGED") == "" {
+		dir, err := ioutil.TempDir("", "runrootless-test")
+		require.NoError(t, err)
+		defer os.RemoveAll(dir)
+		require.NoError(t, os.Chmod(dir, 0755))
+		self, err := ioutil.ReadFile(os.Args[0])
+		require.NoError(t, err)
+		bin := filepath.Join(dir, "image.test")
+		require.NoError(t, ioutil.WriteFile(bin, self, 0755))
+		cmd := exec.Command(bin, "-test.run", "^TestPrepareUnprivileged$", "-test.v")
+		cmd.Env = append(os.Environ(), "RUNROOTLESS_TEST_UNPRIVILEGED=1")
+		cmd.SysProcAttr = &syscall.SysProcAttr{Credential: &syscall.Credential{Uid: 65534, Gid: 65534}}
+		out, err := cmd.CombinedOutput()
+		require.NoError(t, err, string(out))
+		t.Log(string(out))
+		return
+	}
+	layout := writeLayout(t, [][]entry{
+		{
+			{name: "usr/", typeflag: tar.TypeDir, mode: 0555, uid: 1000, gid: 1000},
+			{name: "usr/ro", typeflag: tar.TypeReg, mode: 0444, uid: 1000, body: []byte("x")},
+			{name: "usr/fifo", typeflag: tar.TypeFifo, mode: 0444, uid: 1000},
+		},
+	}, &Config{})
+	defer os.RemoveAll(string(layout))
+	bundleDir := filepath.Join(string(layout), "bundle")
+	require.NoError(t, Prepare(bundleDir, layout, PrepareOptions{Ref: "latest", Jobs: 1}))
+	defer os.Chmod(filepath.Join(bundleDir, "rootfs", "usr"), 0755)
+
+	p := filepath.Join(bundleDir, "rootfs", "usr", "ro")
+	fi, err := os.Lstat(p)
+	require.NoError(t, err)
+	require.Equal(t, os.FileMode(0444), fi.Mode().Perm())
+	o, ok, err := ownership.Get(p)
+	if errors.Cause(err) == unix.ENOTSUP {
+		t.Skip("user xattrs are not supported")
+	}
+	require.NoError(t, err)
+	require.True(t, ok)
+	require.Equal(t, ownership.Owner{UID: 1000, GID: 0}, o)
+}
+
+func TestPrepareCorruptedBlob(t *testing.T) {
+	layout := writeLayout(t, [][]entry{
+		{{name: "file", typeflag: tar.TypeReg, mode: 0644, body: []byte("hello")}},
+	}, &Config{})
+	defer os.RemoveAll(string(layout))
+	m, _, err := layout.Resolve("")
+	require.NoError(t, err)
+	p, err := layout.blobPath(m.Layers[0].Digest)
+	require.NoError(t, err)
+	require.NoError(t, os.Chmod(p, 0644))
+	f, err := os.OpenFile(p, os.O_WRONLY|os.O_APPEND, 0644)
+	require.NoError(t, err)
+	f.Write([]byte("garbage"))
+	f.Close()
+	err = Prepare(filepath.Join(string(layout), "bundle"), layout, PrepareOptions{Jobs: 1})
+	require.Error(t, err)
+}
+
+// benchmarkUnpack unpacks 8 layers of 16 MiB each.
+func benchmarkUnpack(b *testing.B, jobs int) {
+	rnd := rand.New(rand.NewSource(0))
+	var layers [][]entry
+	for i := 0; i < 8; i++ {
+		var entries []entry
+		for j := 0; j < 64; j++ {
+			// half random, half zeros, so that the decompression costs some CPU
+			body := make([]byte, 256<<10)
+			rnd.Read(body[:len(body)/2])
+			entries = append(entries, entry{name: fmt.Sprintf("layer%d/f%d", i, j), typeflag: tar.TypeReg, mode: 0644, body: body})
+		}
+		layers = append(layers, entries)
+	}
+	layout := writeLayout(b, layers, &Config{})
+	defer os.RemoveAll(string(layout))
+	m, _, err := layout.Resolve("")
+	require.NoError(b, err)
+	b.ResetTimer()
+	for i := 0; i < b.N; i++ {
+		rootfs, err := ioutil.TempDir(string(layout), "rootfs")
+		require.NoError(b, err)
+		require.NoError(b, layout.Unpack(rootfs, m, jobs))
+		b.StopTimer()
+		require.NoError(b, os.RemoveAll(rootfs))
+		b.StartTimer()
+	}
+}
+
+func BenchmarkUnpackSerial(b *testing.B) {
+	benchmarkUnpack(b, 1)
+}
+
+func BenchmarkUnpackParallel(b *testing.B) {
+	benchmarkUnpack(b, runtime.NumCPU())
+}
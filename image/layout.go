@@ -0,0 +1,182 @@
+// Package image unpacks images in the OCI image layout into rootless bundles.
+package image
+
+import (
+	"crypto/sha256"
+	"encoding/hex"
+	"encoding/json"
+	"hash"
+	"io"
+	"io/ioutil"
+	"os"
+	"path/filepath"
+	"runtime"
+	"strings"
+
+	"github.com/pkg/errors"
+)
+
+const (
+	mediaTypeIndex          = "application/vnd.oci.image.index.v1+json"
+	mediaTypeManifest       = "application/vnd.oci.image.manifest.v1+json"
+	mediaTypeDockerList     = "application/vnd.docker.distribution.manifest.list.v2+json"
+	mediaTypeDockerManifest = "application/vnd.docker.distribution.manifest.v2+json"
+
+	annotationRefName = "org.opencontainers.image.ref.name"
+)
+
+// Descriptor is a subset of the OCI content descriptor.
+type Descriptor struct {
+	MediaType   string            `json:"mediaType"`
+	Digest      string            `json:"digest"`
+	Size        int64             `json:"size"`
+	Annotations map[string]string `json:"annotations,omitempty"`
+	Platform    *struct {
+		Architecture string `json:"architecture"`
+		OS           string `json:"os"`
+	} `json:"platform,omitempty"`
+}
+
+// Manifest is a subset of the OCI image manifest.
+type Manifest struct {
+	Config Descriptor   `json:"config"`
+	Layers []Descriptor `json:"layers"`
+}
+
+// Config is a subset of the OCI image configuration.
+type Config struct {
+	Config struct {
+		User       string   `json:"User"`
+		Env        []string `json:"Env"`
+		Entrypoint []string `json:"Entrypoint"`
+		Cmd        []string `json:"Cmd"`
+		WorkingDir string   `json:"WorkingDir"`
+	} `json:"config"`
+}
+
+type index struct {
+	Manifests []Descriptor `json:"manifests"`
+}
+
+// Layout is an image layout directory.
+type Layout string
+
+// blobPath returns the path of the blob.
+func (l Layout) blobPath(digest string) (string, error) {
+	parts := strings.SplitN(digest, ":", 2)
+	if len(parts) != 2 || parts[0] != "sha256" || len(parts[1]) != sha256.Size*2 {
+		return "", errors.Errorf("unsupported digest: %q", digest)
+	}
+	return filepath.Join(string(l), "blobs", parts[0], parts[1]), nil
+}
+
+// OpenBlob opens the blob. The digest is verified when the returned reader reaches EOF.
+func (l Layout) OpenBlob(d Descriptor) (io.ReadCloser, error) {
+	p, err := l.blobPath(d.Digest)
+	if err != nil {
+		return nil, err
+	}
+	f, err := os.Open(p)
+	if err != nil {
+		return nil, err
+	}
+	return &verifier{f: f, h: sha256.New(), digest: d.Digest}, nil
+}
+
+func (l Layout) readJSON(d Descriptor, v interface{}) error {
+	r, err := l.OpenBlob(d)
+	if err != nil {
+		return err
+	}
+	defer r.Close()
+	dec := json.NewDecoder(r)
+	if err := dec.Decode(v); err != nil {
+		return errors.Wrapf(err, "decoding %s", d.Digest)
+	}
+	// reach EOF for verification
+	_, err = io.Copy(ioutil.Discard, r)
+	return err
+}
+
+// Resolve returns the manifest of the image named ref, and the digest of the manifest.
+// ref can be empty if the layout contains only one image.
+func (l Layout) Resolve(ref string) (*Manifest, string, error) {
+	f, err := os.Open(filepath.Join(string(l), "index.json"))
+	if err != nil {
+		return nil, "", err
+	}
+	var idx index
+	err = json.NewDecoder(f).Decode(&idx)
+	f.Close()
+	if err != nil {
+		return nil, "", errors.Wrap(err, "decoding index.json")
+	}
+	var candidates []Descriptor
+	for _, d := range idx.Manifests {
+		if ref == "" || d.Annotations[annotationRefName] == ref {
+			candidates = append(candidates, d)
+		}
+	}
+	switch len(candidates) {
+	case 0:
+		return nil, "", errors.Errorf("image %q not found in %s", ref, l)
+	case 1:
+	default:
+		return nil, "", errors.Errorf("%s contains multiple images, specify one of them", l)
+	}
+	d := candidates[0]
+	for d.MediaType == mediaTypeIndex || d.MediaType == mediaTypeDockerList {
+		var nested index
+		if err := l.readJSON(d, &nested); err != nil {
+			return nil, "", err
+		}
+		if d, err = selectPlatform(nested.Manifests); err != nil {
+			return nil, "", err
+		}
+	}
+	if d.MediaType != mediaTypeManifest && d.MediaType != mediaTypeDockerManifest {
+		return nil, "", errors.Errorf("unsupported media type: %q", d.MediaType)
+	}
+	var m Manifest
+	if err := l.readJSON(d, &m); err != nil {
+		return nil, "", err
+	}
+	return &m, d.Digest, nil
+}
+
+func selectPlatform(ds []Descriptor) (Descriptor, error) {
+	for _, d := range ds {
+		if d.Platform == nil || (d.Platform.OS == runtime.GOOS && d.Platform.Architecture == runtime.GOARCH) {
+			return d, nil
+		}
+	}
+	return Descriptor{}, errors.Errorf("no image for %s/%s", runtime.GOOS, runtime.GOARCH)
+}
+
+// ReadConfig reads the image configuration of m.
+func (l Layout) ReadConfig(m *Manifest) (*Config, error) {
+	var c Config
+	err := l.readJSON(m.Config, &c)
+	return &c, err
+}
+
+type verifier struct {
+	f      *os.File
+	h      hash.Hash
+	digest string
+}
+
+func (v *verifier) Read(p []byte) (int, error) {
+	n, err := v.f.Read(p)
+	v.h.Write(p[:n])
+	if err == io.EOF {
+		if actual := "sha256:" + hex.EncodeToString(v.h.Sum(nil)); actual != v.digest {
+			return n, errors.Errorf("digest mismatch: expected %s, got %s", v.digest, actual)
+		}
+	}
+	return n, err
+}
+
+func (v *verifier) Close() error {
+	return v.f.Close()
+}
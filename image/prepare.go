@@ -0,0 +1,96 @@
+package image
+
+import (
+	"encoding/json"
+	"io/ioutil"
+	"os"
+	"path/filepath"
+
+	"github.com/pkg/errors"
+	"github.com/rootless-containers/runrootless/base"
+)
+
+// PrepareOptions are the options for Prepare.
+type PrepareOptions struct {
+	// Ref is the name of the image in the layout. It can be empty if the layout contains only one image.
+	Ref string
+	// Jobs is the number of layers decompressed concurrently.
+	Jobs int
+	// Base unpacks the image into the base rootfs shared by the bundles of the same image,
+	// instead of rootfs/ of the bundle.
+	Base bool
+}
+
+// Prepare creates a bundle at bundleDir from the image in layout:
+// rootfs/ with the layers unpacked (unless opts.Base is set), and config.json.
+func Prepare(bundleDir string, layout Layout, opts PrepareOptions) error {
+	m, digest, err := layout.Resolve(opts.Ref)
+	if err != nil {
+		return err
+	}
+	c, err := layout.ReadConfig(m)
+	if err != nil {
+		return err
+	}
+	unpack := func(rootfs string) error {
+		if err := os.MkdirAll(rootfs, 0755); err != nil {
+			return err
+		}
+		if err := layout.Unpack(rootfs, m, opts.Jobs); err != nil {
+			return err
+		}
+		return setUpDNS(rootfs)
+	}
+	spec := Spec(c)
+	if opts.Base {
+		if err := base.Import(digest, unpack); err != nil {
+			return err
+		}
+		if spec.Annotations == nil {
+			spec.Annotations = make(map[string]string)
+		}
+		spec.Annotations[base.Annotation] = digest
+		if err := os.MkdirAll(bundleDir, 0755); err != nil {
+			return err
+		}
+	} else {
+		rootfs := filepath.Join(bundleDir, "rootfs")
+		if _, err := os.Lstat(rootfs); err == nil {
+			return errors.Errorf("%s already exists", rootfs)
+		}
+		if err := unpack(rootfs); err != nil {
+			return err
+		}
+	}
+	data, err := json.MarshalIndent(spec, "", "\t")
+	if err != nil {
+		return err
+	}
+	return ioutil.WriteFile(filepath.Join(bundleDir, "config.json"), data, 0666)
+}
+
+// setUpDNS copies the DNS configuration of the host, as examples/common/3-set-up-dns.sh does.
+func setUpDNS(rootfs string) error {
+	etc := filepath.Join(rootfs, "etc")
+	if fi, err := os.Lstat(etc); err != nil || !fi.IsDir() {
+		return nil
+	}
+	for _, name := range []string{"hosts", "resolv.conf"} {
+		data, err := ioutil.ReadFile(filepath.Join("/etc", name))
+		if os.IsNotExist(err) {
+			continue
+		}
+		if err != nil {
+			return err
+		}
+		p := filepath.Join(etc, name)
+		// may be a symlink, e.g. to ../run/systemd/resolve/stub-resolv.conf
+		if err := os.RemoveAll(p); err != nil {
+			return err
+		}
+		if err := ioutil.WriteFile(p, data, 0644); err != nil {
+			return err
+		}
+	}
+	return nil
+}
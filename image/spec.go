@@ -0,0 +1,42 @@
+package image
+
+import (
+	"strings"
+
+	"github.com/opencontainers/runc/libcontainer/specconv"
+	"github.com/opencontainers/runtime-spec/specs-go"
+)
+
+// Spec returns the runtime spec for c: the one generated by `runc spec`, with a writable
+// rootfs and the process taken from the image configuration.
+// The user in the image configuration is not used, as runrootless runs the process as the emulated root.
+func Spec(c *Config) *specs.Spec {
+	spec := specconv.Example()
+	spec.Root.Readonly = false
+	var args []string
+	args = append(args, c.Config.Entrypoint...)
+	args = append(args, c.Config.Cmd...)
+	if len(args) > 0 {
+		spec.Process.Args = args
+	}
+	if len(c.Config.Env) > 0 {
+		env := append([]string(nil), c.Config.Env...)
+		if !hasEnv(env, "TERM") {
+			env = append(env, "TERM=xterm")
+		}
+		spec.Process.Env = env
+	}
+	if c.Config.WorkingDir != "" {
+		spec.Process.Cwd = c.Config.WorkingDir
+	}
+	return spec
+}
+
+func hasEnv(env []string, key string) bool {
+	for _, kv := range env {
+		if strings.HasPrefix(kv, key+"=") {
+			return true
+		}
+	}
+	return false
+}
@@ -0,0 +1,486 @@
+package image
+
+import (
+	"archive/tar"
+	"bytes"
+	"compress/gzip"
+	"io"
+	"io/ioutil"
+	"os"
+	"path"
+	"path/filepath"
+	"sort"
+	"strings"
+	"sync"
+
+	"github.com/pkg/errors"
+	"github.com/rootless-containers/runrootless/fsutil"
+	"github.com/rootless-containers/runrootless/ownership"
+	"golang.org/x/sys/unix"
+)
+
+const (
+	// chunkSize and chunksPerLayer bound the memory used for decompressing a layer
+	// ahead of its extraction, and for the file contents queued by its extraction.
+	chunkSize      = 1 << 20
+	chunksPerLayer = 32
+
+	whiteoutPrefix = ".wh."
+	whiteoutOpaque = ".wh..wh..opq"
+)
+
+// Unpack extracts the layers of m into rootfs.
+// Up to jobs layers are decompressed concurrently, ahead of the extraction,
+// which is sequential across layers as whiteouts depend on the lower layers.
+// Within a layer, up to jobs regular files are written concurrently.
+// The ownership recorded in the layers is stored in the user.rootlesscontainers xattr.
+func (l Layout) Unpack(rootfs string, m *Manifest, jobs int) error {
+	if jobs < 1 {
+		jobs = 1
+	}
+	layers := l.prefetch(m.Layers, jobs)
+	defer func() {
+		for _, r := range layers {
+			r.Close()
+		}
+	}()
+	u := &unpacker{root: rootfs, dirs: make(map[string]*tar.Header), jobs: jobs}
+	for i, r := range layers {
+		err := u.applyLayer(r)
+		if err == nil {
+			// read the padding after the end of the archive, so that the digest is verified
+			_, err = io.Copy(ioutil.Discard, r)
+		}
+		if err != nil {
+			return errors.Wrapf(err, "layer %s", m.Layers[i].Digest)
+		}
+		r.Close()
+	}
+	return u.finish()
+}
+
+type chunk struct {
+	b   []byte
+	err error
+}
+
+// prefetched is a tar stream decompressed ahead by a goroutine.
+type prefetched struct {
+	ch        chan chunk
+	done      chan struct{}
+	closeOnce sync.Once
+	cur       []byte
+	err       error
+}
+
+func (p *prefetched) Read(b []byte) (int, error) {
+	for len(p.cur) == 0 {
+		if p.err != nil {
+			return 0, p.err
+		}
+		c, ok := <-p.ch
+		if !ok {
+			p.err = io.EOF
+			continue
+		}
+		p.cur, p.err = c.b, c.err
+	}
+	n := copy(b, p.cur)
+	p.cur = p.cur[n:]
+	return n, nil
+}
+
+// Close stops the decompression.
+func (p *prefetched) Close() error {
+	p.closeOnce.Do(func() { close(p.done) })
+	return nil
+}
+
+func (p *prefetched) send(c chunk) bool {
+	select {
+	case p.ch <- c:
+		return true
+	case <-p.done:
+		return false
+	}
+}
+
+// prefetch starts decompressing the layers, up to jobs layers at a time.
+// The slots are acquired in the layer order, so the layer being extracted always holds one.
+func (l Layout) prefetch(layers []Descriptor, jobs int) []*prefetched {
+	ps := make([]*prefetched, len(layers))
+	for i := range ps {
+		ps[i] = &prefetched{ch: make(chan chunk, chunksPerLayer), done: make(chan struct{})}
+	}
+	sem := make(chan struct{}, jobs)
+	go func() {
+		for i, d := range layers {
+			sem <- struct{}{}
+			go func(p *prefetched, d Descriptor) {
+				defer func() { <-sem }()
+				defer close(p.ch)
+				if err := l.decompress(p, d); err != nil {
+					p.send(chunk{err: err})
+				}
+			}(ps[i], d)
+		}
+	}()
+	return ps
+}
+
+func (l Layout) decompress(p *prefetched, d Descriptor) error {
+	select {
+	case <-p.done:
+		return nil
+	default:
+	}
+	blob, err := l.OpenBlob(d)
+	if err != nil {
+		return err
+	}
+	defer blob.Close()
+	var r io.Reader
+	switch {
+	case strings.HasSuffix(d.MediaType, "+gzip") || strings.HasSuffix(d.MediaType, ".gzip"):
+		zr, err := gzip.NewReader(blob)
+		if err != nil {
+			return err
+		}
+		defer zr.Close()
+		r = zr
+	case strings.HasSuffix(d.MediaType, ".tar"):
+		r = blob
+	default:
+		return errors.Errorf("unsupported layer media type: %q", d.MediaType)
+	}
+	for {
+		buf := make([]byte, chunkSize)
+		n, err := io.ReadFull(r, buf)
+		if n > 0 && !p.send(chunk{b: buf[:n]}) {
+			return nil
+		}
+		switch err {
+		case nil:
+		case io.EOF, io.ErrUnexpectedEOF:
+			// drain the blob for digest verification
+			_, err = io.Copy(ioutil.Discard, blob)
+			return err
+		default:
+			return err
+		}
+	}
+}
+
+type unpacker struct {
+	root string
+	// dirs are the directories whose mode and times are applied in finish,
+	// so that they stay writable during the extraction.
+	dirs map[string]*tar.Header
+	// jobs is the number of goroutines writing the regular files of a layer.
+	jobs int
+}
+
+func (u *unpacker) applyLayer(r io.Reader) (err error) {
+	// the paths created in this layer are not affected by the opaque whiteouts in this layer
+	created := make(map[string]bool)
+	var w *fileWriter
+	if u.jobs > 1 {
+		w = newFileWriter(u.jobs)
+		defer func() {
+			if werr := w.wait(); err == nil {
+				err = werr
+			}
+		}()
+	}
+	tr := tar.NewReader(r)
+	for {
+		hdr, err := tr.Next()
+		if err == io.EOF {
+			return nil
+		}
+		if err != nil {
+			return err
+		}
+		name := path.Clean("/" + hdr.Name)
+		if name == "/" {
+			continue
+		}
+		dir, base := path.Split(name)
+		switch {
+		case base == whiteoutOpaque:
+			if err := u.opaque(dir, created); err != nil {
+				return err
+			}
+		case strings.HasPrefix(base, whiteoutPrefix):
+			p, err := fsutil.SecureJoin(u.root, path.Join(dir, strings.TrimPrefix(base, whiteoutPrefix)))
+			if err != nil {
+				return err
+			}
+			if err := u.remove(p); err != nil {
+				return err
+			}
+		default:
+			p, err := fsutil.SecureJoin(u.root, name)
+			if err != nil {
+				return err
+			}
+			if err := u.applyEntry(p, hdr, tr, w); err != nil {
+				return errors.Wrap(err, name)
+			}
+			created[p] = true
+		}
+		if w != nil {
+			if err := w.failed(); err != nil {
+				return err
+			}
+		}
+	}
+}
+
+// opaque removes the children of dir that were not created in the current layer.
+// The directories of the current layer that replace a lower directory keep the lower children,
+// so they are cleared recursively.
+func (u *unpacker) opaque(dir string, created map[string]bool) error {
+	resolved, err := fsutil.MkdirAllInRoot(u.root, dir)
+	if err != nil {
+		return err
+	}
+	return u.removeLower(filepath.Join(u.root, resolved), created)
+}
+
+func (u *unpacker) removeLower(hostDir string, created map[string]bool) error {
+	names, err := readDirNames(hostDir)
+	if err != nil {
+		return err
+	}
+	for _, name := range names {
+		p := filepath.Join(hostDir, name)
+		if !created[p] {
+			if err := u.remove(p); err != nil {
+				return err
+			}
+			continue
+		}
+		if fi, err := os.Lstat(p); err == nil && fi.IsDir() {
+			if err := u.removeLower(p, created); err != nil {
+				return err
+			}
+		}
+	}
+	return nil
+}
+
+// remove removes p and forgets the directories under it.
+func (u *unpacker) remove(p string) error {
+	if err := os.RemoveAll(p); err != nil {
+		return err
+	}
+	prefix := p + string(filepath.Separator)
+	for d := range u.dirs {
+		if d == p || strings.HasPrefix(d, prefix) {
+			delete(u.dirs, d)
+		}
+	}
+	return nil
+}
+
+func readDirNames(dir string) ([]string, error) {
+	f, err := os.Open(dir)
+	if err != nil {
+		return nil, err
+	}
+	defer f.Close()
+	return f.Readdirnames(-1)
+}
+
+// applyEntry creates p from hdr.
+// If w is not nil, the contents and the metadata of a regular file may be written by w
+// after applyEntry returns.
+func (u *unpacker) applyEntry(p string, hdr *tar.Header, r io.Reader, w *fileWriter) error {
+	if fi, err := os.Lstat(p); err == nil && !(fi.IsDir() && hdr.Typeflag == tar.TypeDir) {
+		if err := u.remove(p); err != nil {
+			return err
+		}
+	}
+	mode := hdr.FileInfo().Mode()
+	switch hdr.Typeflag {
+	case tar.TypeDir:
+		if err := os.Mkdir(p, 0755); err != nil && !os.IsExist(err) {
+			return err
+		}
+		u.dirs[p] = hdr
+		// The xattr is set before the mode, as it requires write permission on the inode.
+		// A directory that replaces a lower one does not inherit its owner.
+		if hdr.Uid == 0 && hdr.Gid == 0 {
+			return ownership.Remove(p)
+		}
+		// the mode is applied by finish
+		return ownership.Set(p, ownership.Owner{UID: uint32(hdr.Uid), GID: uint32(hdr.Gid)})
+	case tar.TypeReg, tar.TypeRegA:
+		f, err := os.OpenFile(p, os.O_WRONLY|os.O_CREATE|os.O_EXCL, 0600)
+		if err != nil {
+			return err
+		}
+		if w != nil {
+			return w.write(f, hdr, r)
+		}
+		return writeFile(f, hdr, r)
+	case tar.TypeSymlink:
+		return os.Symlink(hdr.Linkname, p)
+	case tar.TypeLink:
+		target, err := fsutil.SecureJoin(u.root, hdr.Linkname)
+		if err != nil {
+			return err
+		}
+		// the ownership and the times are shared with the target
+		return os.Link(target, p)
+	case tar.TypeFifo:
+		// user.* xattrs are only allowed on regular files and directories,
+		// so the ownership of a fifo is not emulated.
+		if err := unix.Mkfifo(p, uint32(mode.Perm())); err != nil {
+			return err
+		}
+		return os.Chtimes(p, hdr.ModTime, hdr.ModTime)
+	default:
+		// device nodes cannot be created without privileges
+		return nil
+	}
+}
+
+// writeFile writes the contents read from r, the ownership, the mode and the times of hdr
+// to the new file f, and closes f.
+// The file descriptor is used rather than the path, which may be removed or replaced
+// by the following entries of the layer in the meantime.
+func writeFile(f *os.File, hdr *tar.Header, r io.Reader) error {
+	err := func() error {
+		if _, err := io.Copy(f, r); err != nil {
+			return err
+		}
+		// The xattr is set before the mode, as it requires write permission on the inode.
+		if hdr.Uid != 0 || hdr.Gid != 0 {
+			if err := ownership.SetFile(f, ownership.Owner{UID: uint32(hdr.Uid), GID: uint32(hdr.Gid)}); err != nil {
+				return err
+			}
+		}
+		if err := f.Chmod(hdr.FileInfo().Mode()); err != nil {
+			return err
+		}
+		tv := unix.NsecToTimeval(hdr.ModTime.UnixNano())
+		return unix.Futimes(int(f.Fd()), []unix.Timeval{tv, tv})
+	}()
+	if cerr := f.Close(); err == nil {
+		err = cerr
+	}
+	return err
+}
+
+// fileWriter writes regular files concurrently with the extraction of the following entries of a layer.
+// The extraction stays sequential for everything that touches the paths (creation, removal, hardlinks),
+// so whiteouts and opaque whiteouts see the same tree as with a sequential extraction.
+type fileWriter struct {
+	ch chan writeJob
+	// budget holds a token per chunkSize of file contents buffered in memory.
+	budget chan struct{}
+	wg     sync.WaitGroup
+	mu     sync.Mutex
+	err    error
+}
+
+type writeJob struct {
+	f      *os.File
+	hdr    *tar.Header
+	data   []byte
+	tokens int
+}
+
+func newFileWriter(jobs int) *fileWriter {
+	w := &fileWriter{
+		ch:     make(chan writeJob, jobs),
+		budget: make(chan struct{}, chunksPerLayer),
+	}
+	for i := 0; i < chunksPerLayer; i++ {
+		w.budget <- struct{}{}
+	}
+	w.wg.Add(jobs)
+	for i := 0; i < jobs; i++ {
+		go w.run()
+	}
+	return w
+}
+
+func (w *fileWriter) run() {
+	defer w.wg.Done()
+	for j := range w.ch {
+		var err error
+		if w.failed() == nil {
+			err = writeFile(j.f, j.hdr, bytes.NewReader(j.data))
+		} else {
+			j.f.Close()
+		}
+		for i := 0; i < j.tokens; i++ {
+			w.budget <- struct{}{}
+		}
+		if err != nil {
+			w.mu.Lock()
+			if w.err == nil {
+				w.err = errors.Wrap(err, j.hdr.Name)
+			}
+			w.mu.Unlock()
+		}
+	}
+}
+
+// write reads the contents of f from r and queues f.
+// A file too large for a quarter of the budget is written before write returns.
+func (w *fileWriter) write(f *os.File, hdr *tar.Header, r io.Reader) error {
+	tokens := int((hdr.Size + chunkSize - 1) / chunkSize)
+	if tokens > chunksPerLayer/4 {
+		return writeFile(f, hdr, r)
+	}
+	for i := 0; i < tokens; i++ {
+		<-w.budget
+	}
+	data := make([]byte, hdr.Size)
+	if _, err := io.ReadFull(r, data); err != nil {
+		f.Close()
+		for i := 0; i < tokens; i++ {
+			w.budget <- struct{}{}
+		}
+		return err
+	}
+	w.ch <- writeJob{f: f, hdr: hdr, data: data, tokens: tokens}
+	return nil
+}
+
+// failed returns the first error of the queued files.
+func (w *fileWriter) failed() error {
+	w.mu.Lock()
+	defer w.mu.Unlock()
+	return w.err
+}
+
+// wait waits for the queued files.
+func (w *fileWriter) wait() error {
+	close(w.ch)
+	w.wg.Wait()
+	return w.failed()
+}
+
+// finish applies the mode and the times of the directories, children first.
+func (u *unpacker) finish() error {
+	var dirs []string
+	for p := range u.dirs {
+		dirs = append(dirs, p)
+	}
+	sort.Sort(sort.Reverse(sort.StringSlice(dirs)))
+	for _, p := range dirs {
+		hdr := u.dirs[p]
+		if err := os.Chmod(p, hdr.FileInfo().Mode()); err != nil {
+			return err
+		}
+		if err := os.Chtimes(p, hdr.ModTime, hdr.ModTime); err != nil {
+			return err
+		}
+	}
+	return nil
+}
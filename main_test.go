@@ -0,0 +1,160 @@
+package main
+
+import (
+	"bytes"
+	"fmt"
+	"io/ioutil"
+	"os"
+	"os/exec"
+	"path/filepath"
+	"strconv"
+	"strings"
+	"testing"
+	"time"
+
+	"github.com/stretchr/testify/require"
+)
+
+// TestMain runs the test binary as runrootless if RUNROOTLESS_TEST_MAIN is set,
+// launching runc with execve ("exec") or as a child process ("fork").
+func TestMain(m *testing.M) {
+	switch os.Getenv("RUNROOTLESS_TEST_MAIN") {
+	case "exec":
+		main()
+		os.Exit(0)
+	case "fork":
+		launchRunc = forkRunc
+		main()
+		os.Exit(0)
+	}
+	os.Exit(m.Run())
+}
+
+// benchmarkRun measures the latency of 'runrootless run' of the bundle in
+// $RUNROOTLESS_BENCH_BUNDLE, whose process should exit immediately, e.g. the
+// fixture of misc/startbench with "/startbench job".
+// The transformed bundle is cached after the first iteration.
+// It also reports the peak RSS of the processes that 'run' keeps on the host outside the
+// container: "wrapper-KiB" for runrootless itself, and "launcher-KiB" for runrootless and runc.
+func benchmarkRun(b *testing.B, mode string) {
+	bundle := os.Getenv("RUNROOTLESS_BENCH_BUNDLE")
+	if bundle == "" {
+		b.Skip("RUNROOTLESS_BENCH_BUNDLE is not set")
+	}
+	if _, err := exec.LookPath(runc); err != nil {
+		b.Skip(err)
+	}
+	root, err := ioutil.TempDir("", "runrootless-test")
+	require.NoError(b, err)
+	defer os.RemoveAll(root)
+	env := append(os.Environ(), "RUNROOTLESS_TEST_MAIN="+mode)
+	var wrapperKiB, launcherKiB uint64
+	b.ResetTimer()
+	for i := 0; i < b.N; i++ {
+		id := fmt.Sprintf("runrootless-bench-%d-%d", os.Getpid(), i)
+		cmd := exec.Command(os.Args[0], "--root", root, "run", "--bundle", bundle, id)
+		cmd.Env = env
+		var out bytes.Buffer
+		cmd.Stdout, cmd.Stderr = &out, &out
+		require.NoError(b, cmd.Start())
+		peak := sampleRSS(cmd.Process.Pid)
+		err := cmd.Wait()
+		wrapper, launcher := peak()
+		wrapperKiB += wrapper
+		launcherKiB += launcher
+		if err != nil {
+			b.Fatalf("%v: %s", err, out.Bytes())
+		}
+		b.StopTimer()
+		exec.Command(runc, "--root", root, "delete", "-f", id).Run()
+		b.StartTimer()
+	}
+	b.ReportMetric(float64(wrapperKiB)/float64(b.N), "wrapper-KiB")
+	b.ReportMetric(float64(launcherKiB)/float64(b.N), "launcher-KiB")
+}
+
+// sampleRSS samples the RSS of pid and its descendants in the PID namespace of the benchmark,
+// i.e. without the processes of the container, until the returned function is called.
+// The function returns the peak RSS in KiB of the processes executing the test binary (the
+// runrootless wrapper), and of all of them (the wrapper and runc).
+func sampleRSS(pid int) func() (wrapper, launcher uint64) {
+	self, _ := os.Readlink("/proc/self/exe")
+	pidns, _ := os.Readlink("/proc/self/ns/pid")
+	done := make(chan struct{})
+	result := make(chan [2]uint64)
+	go func() {
+		var peak [2]uint64
+		ticker := time.NewTicker(time.Millisecond)
+		defer ticker.Stop()
+		for {
+			var cur [2]uint64
+			for _, p := range processTree(pid) {
+				if ns, err := os.Readlink(fmt.Sprintf("/proc/%d/ns/pid", p)); err != nil || ns != pidns {
+					continue
+				}
+				ps, _, err := readProcStats(p)
+				if err != nil {
+					continue
+				}
+				if exe, _ := os.Readlink(fmt.Sprintf("/proc/%d/exe", p)); exe == self {
+					cur[0] += ps.RSSKiB
+				}
+				cur[1] += ps.RSSKiB
+			}
+			for i := range peak {
+				if cur[i] > peak[i] {
+					peak[i] = cur[i]
+				}
+			}
+			select {
+			case <-done:
+				result <- peak
+				return
+			case <-ticker.C:
+			}
+		}
+	}()
+	return func() (uint64, uint64) {
+		close(done)
+		peak := <-result
+		return peak[0], peak[1]
+	}
+}
+
+// processTree returns pid and its descendants, using /proc/<pid>/task/<tid>/children.
+func processTree(pid int) []int {
+	pids := []int{pid}
+	for i := 0; i < len(pids); i++ {
+		tasks, _ := filepath.Glob(fmt.Sprintf("/proc/%d/task/*/children", pids[i]))
+		for _, t := range tasks {
+			b, err := ioutil.ReadFile(t)
+			if err != nil {
+				continue
+			}
+			for _, f := range strings.Fields(string(b)) {
+				if child, err := strconv.Atoi(f); err == nil {
+					pids = append(pids, child)
+				}
+			}
+		}
+	}
+	return pids
+}
+
+func TestSampleRSS(t *testing.T) {
+	cmd := exec.Command("sh", "-c", "sleep 0.2 & wait")
+	require.NoError(t, cmd.Start())
+	peak := sampleRSS(cmd.Process.Pid)
+	require.NoError(t, cmd.Wait())
+	wrapper, launcher := peak()
+	require.Equal(t, uint64(0), wrapper)
+	require.NotZero(t, launcher)
+}
+
+func BenchmarkRunFork(b *testing.B) {
+	benchmarkRun(b, "fork")
+}
+
+func BenchmarkRunExec(b *testing.B) {
+	benchmarkRun(b, "exec")
+}
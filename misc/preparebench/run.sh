@@ -0,0 +1,28 @@
+#!/bin/sh
+# Usage: ./run.sh OCI_LAYOUT REF [COUNT]
+# e.g. skopeo copy docker://ubuntu oci:ubuntu-oci:latest && ./run.sh ubuntu-oci latest
+set -e
+cd $(dirname $0)
+
+if [ -z $2 ]; then
+	echo "Usage: $0 OCI_LAYOUT REF [COUNT]"
+	exit 1
+fi
+layout=$1
+ref=$2
+count=${3:-3}
+
+rm -rf bundle
+elapsed() {
+	begin=$(date +%s.%N)
+	"$@" >/dev/null
+	end=$(date +%s.%N)
+	echo "$end - $begin" | bc
+}
+
+for i in $(seq $count); do
+	echo "umoci: $(elapsed umoci unpack --rootless --image $layout:$ref bundle) s"
+	chmod -R u+w bundle && rm -rf bundle
+	echo "runrootless: $(elapsed runrootless prepare --ref $ref $layout bundle) s"
+	chmod -R u+w bundle && rm -rf bundle
+done
@@ -0,0 +1,48 @@
+#!/bin/sh
+# Usage: ./exec.sh [RATE...]
+# RATE: exec calls per second (default: 10 50 100)
+# Environment: DURATION (default: 10s)
+# Results are appended to ./results/<date>.jsonl
+set -e
+cd $(dirname $0)
+
+rates="$*"
+[ -z "$rates" ] && rates="10 50 100"
+duration=${DURATION:-10s}
+
+set -x
+
+## 0. Build the fixture rootfs: a single static binary, no network access required
+rm -rf bundle
+mkdir -p bundle/rootfs/tmp bundle/rootfs/proc bundle/rootfs/dev bundle/rootfs/sys results
+CGO_ENABLED=0 go build -o bundle/rootfs/startbench .
+(cd bundle && runc spec)
+sed -i -e 's/"readonly": true/"readonly": false/' -e 's/"terminal": true/"terminal": false/' \
+	-e 's/"sh"/"\/startbench", "pause"/' bundle/config.json
+
+## 1. Run
+# agent: runrootless exec via the agent, under the PRoot tracer of the container
+# proot: a new PRoot tracer per exec, the workaround without the agent
+# runc:  runrootless exec redirected to runc, without PRoot (no root emulation)
+# -stats samples the PID namespace of the container, so the per-exec tracers of the proot mode are
+# accounted even though they are children of the host runc exec process.
+bench=bundle/rootfs/startbench
+bundle=$(pwd)/bundle
+out=results/$(date +%Y%m%d-%H%M%S).jsonl
+for mode in agent proot runc; do
+	id=startbench-exec-$$-$mode
+	agent=0
+	[ $mode = agent ] && agent=1
+	RUNROOTLESS_EXEC_AGENT=$agent runrootless run -d --bundle $bundle $id </dev/null >/dev/null 2>&1
+	case $mode in
+	agent | runc) cmd="runrootless exec $id /startbench job" ;;
+	proot) cmd="runc exec $id /dev/proot/proot -0 /startbench job" ;;
+	esac
+	for rate in $rates; do
+		$bench -label $mode -rate $rate -duration $duration -warmup 1 -stats $id $cmd >>$out
+	done
+	runc delete -f $id
+done
+
+set +x
+echo "Results: $out"
@@ -0,0 +1,210 @@
+// Command startbench starts a command at a sustained arrival rate and prints one JSON line
+// with the percentiles of the start latency: the time from the scheduled arrival until the
+// first byte on the stdout of the command.
+// Arrivals are open-loop, so the latency includes the queueing behind the previous commands.
+//
+// With -stats, the PRoot tracers of a container are sampled with 'runrootless stats' during the run.
+//
+// "startbench job" is the job executed in the container: it prints a line and exits.
+// "startbench pause" blocks forever, as the main process of a container for exec.
+// See README.md.
+package main
+
+import (
+	"bufio"
+	"encoding/json"
+	"flag"
+	"fmt"
+	"io"
+	"io/ioutil"
+	"os"
+	"os/exec"
+	"sort"
+	"strconv"
+	"strings"
+	"sync"
+	"time"
+)
+
+var (
+	label    = flag.String("label", "", "label to include in the output, e.g. the runtime mode")
+	rate     = flag.Float64("rate", 10, "arrivals per second")
+	duration = flag.Duration("duration", 30*time.Second, "duration of the arrivals")
+	warmup   = flag.Int("warmup", 0, "number of sequential commands to run before measuring")
+	stats    = flag.String("stats", "", "container to sample with 'runrootless stats' during the run")
+	root     = flag.String("root", "", "runc root directory for -stats")
+)
+
+type result struct {
+	Label         string  `json:"label,omitempty"`
+	Rate          float64 `json:"rate"`
+	Count         int     `json:"count"`
+	Errors        int     `json:"errors"`
+	StartP50Ns    int64   `json:"startP50Ns"`
+	StartP90Ns    int64   `json:"startP90Ns"`
+	StartP99Ns    int64   `json:"startP99Ns"`
+	StartMaxNs    int64   `json:"startMaxNs"`
+	CompleteP50Ns int64   `json:"completeP50Ns"`
+	CompleteP99Ns int64   `json:"completeP99Ns"`
+	// MaxTracers and MaxTracerRSSKiB are the maxima of the number and the total RSS
+	// of the tracers of the container sampled with -stats.
+	MaxTracers      int    `json:"maxTracers,omitempty"`
+	MaxTracerRSSKiB uint64 `json:"maxTracerRSSKiB,omitempty"`
+}
+
+// tracerStats is the subset of the output of 'runrootless stats'.
+type tracerStats struct {
+	Tracers []struct {
+		RSSKiB uint64 `json:"rssKiB"`
+	} `json:"tracers"`
+}
+
+func main() {
+	if len(os.Args) > 1 {
+		switch os.Args[1] {
+		case "job":
+			fmt.Println("ready")
+			return
+		case "pause":
+			select {}
+		}
+	}
+	flag.Usage = func() {
+		fmt.Fprintf(os.Stderr, "Usage: %s [flags] COMMAND [ARG...]\n", os.Args[0])
+		fmt.Fprintf(os.Stderr, "%q in the arguments is replaced with the sequence number of the arrival.\n", "%d")
+		flag.PrintDefaults()
+	}
+	flag.Parse()
+	if flag.NArg() == 0 || *rate <= 0 {
+		flag.Usage()
+		os.Exit(2)
+	}
+	for i := 0; i < *warmup; i++ {
+		if _, _, err := start(-1-i, time.Now()); err != nil {
+			fmt.Fprintf(os.Stderr, "warmup: %v\n", err)
+			os.Exit(1)
+		}
+	}
+
+	var (
+		mu               sync.Mutex
+		starts, complete []time.Duration
+		errs             int
+		wg               sync.WaitGroup
+	)
+	res := result{Label: *label, Rate: *rate}
+	done := make(chan struct{})
+	sampled := make(chan struct{})
+	go func() {
+		defer close(sampled)
+		if *stats != "" {
+			sample(&res, done)
+		}
+	}()
+
+	interval := time.Duration(float64(time.Second) / *rate)
+	n := int(duration.Seconds() * *rate)
+	begin := time.Now()
+	for i := 0; i < n; i++ {
+		arrival := begin.Add(time.Duration(i) * interval)
+		time.Sleep(time.Until(arrival))
+		wg.Add(1)
+		go func(i int) {
+			defer wg.Done()
+			s, c, err := start(i, arrival)
+			mu.Lock()
+			defer mu.Unlock()
+			if err != nil {
+				fmt.Fprintf(os.Stderr, "%d: %v\n", i, err)
+				errs++
+				return
+			}
+			starts = append(starts, s)
+			complete = append(complete, c)
+		}(i)
+	}
+	wg.Wait()
+	close(done)
+	<-sampled
+
+	res.Count, res.Errors = len(starts), errs
+	if len(starts) > 0 {
+		res.StartP50Ns = percentile(starts, 0.50)
+		res.StartP90Ns = percentile(starts, 0.90)
+		res.StartP99Ns = percentile(starts, 0.99)
+		res.StartMaxNs = percentile(starts, 1)
+		res.CompleteP50Ns = percentile(complete, 0.50)
+		res.CompleteP99Ns = percentile(complete, 0.99)
+	}
+	json.NewEncoder(os.Stdout).Encode(res)
+}
+
+// start runs the i-th command, and returns the start and the completion latency since arrival.
+func start(i int, arrival time.Time) (time.Duration, time.Duration, error) {
+	args := make([]string, flag.NArg())
+	for j, a := range flag.Args() {
+		args[j] = strings.Replace(a, "%d", strconv.Itoa(i), -1)
+	}
+	cmd := exec.Command(args[0], args[1:]...)
+	cmd.Stderr = os.Stderr
+	stdout, err := cmd.StdoutPipe()
+	if err != nil {
+		return 0, 0, err
+	}
+	if err := cmd.Start(); err != nil {
+		return 0, 0, err
+	}
+	r := bufio.NewReader(stdout)
+	_, err = r.ReadByte()
+	started := time.Since(arrival)
+	io.Copy(ioutil.Discard, r)
+	if waitErr := cmd.Wait(); waitErr != nil {
+		return 0, 0, waitErr
+	}
+	if err != nil {
+		return 0, 0, fmt.Errorf("no output: %v", err)
+	}
+	return started, time.Since(arrival), nil
+}
+
+// sample records the maxima of the tracers of the container every 100ms until done is closed.
+func sample(res *result, done <-chan struct{}) {
+	args := []string{"stats", *stats}
+	if *root != "" {
+		args = append([]string{"--root", *root}, args...)
+	}
+	t := time.NewTicker(100 * time.Millisecond)
+	defer t.Stop()
+	for {
+		select {
+		case <-done:
+			return
+		case <-t.C:
+		}
+		out, err := exec.Command("runrootless", args...).Output()
+		if err != nil {
+			fmt.Fprintf(os.Stderr, "stats: %v\n", err)
+			continue
+		}
+		var st tracerStats
+		if err := json.Unmarshal(out, &st); err != nil {
+			fmt.Fprintf(os.Stderr, "stats: %v\n", err)
+			continue
+		}
+		var rss uint64
+		for _, tr := range st.Tracers {
+			rss += tr.RSSKiB
+		}
+		if len(st.Tracers) > res.MaxTracers {
+			res.MaxTracers = len(st.Tracers)
+		}
+		if rss > res.MaxTracerRSSKiB {
+			res.MaxTracerRSSKiB = rss
+		}
+	}
+}
+
+func percentile(d []time.Duration, q float64) int64 {
+	sort.Slice(d, func(i, j int) bool { return d[i] < d[j] })
+	return int64(d[int(q*float64(len(d)-1))])
+}
@@ -0,0 +1,39 @@
+#!/bin/sh
+# Usage: ./run.sh [RATE...]
+# RATE: arrivals per second (default: 1 5 10 20)
+# Environment: DURATION (default: 30s), POOL_SIZE (default: 8)
+# Results are appended to ./results/<date>.jsonl
+set -e
+cd $(dirname $0)
+
+rates="$*"
+[ -z "$rates" ] && rates="1 5 10 20"
+duration=${DURATION:-30s}
+pool_size=${POOL_SIZE:-8}
+
+set -x
+
+## 0. Build the fixture rootfs: a single static binary, no network access required
+rm -rf bundle
+mkdir -p bundle/rootfs/tmp bundle/rootfs/proc bundle/rootfs/dev bundle/rootfs/sys results
+CGO_ENABLED=0 go build -o bundle/rootfs/startbench .
+(cd bundle && runc spec)
+sed -i -e 's/"readonly": true/"readonly": false/' -e 's/"terminal": true/"terminal": false/' \
+	-e 's/"sh"/"\/startbench", "job"/' bundle/config.json
+
+## 1. Run
+bench=bundle/rootfs/startbench
+bundle=$(pwd)/bundle
+out=results/$(date +%Y%m%d-%H%M%S).jsonl
+for rate in $rates; do
+	$bench -label nopool -rate $rate -duration $duration -warmup 1 \
+		runrootless run --bundle $bundle startbench-$$-%d >>$out
+
+	runrootless pool fill --bundle $bundle --size $pool_size
+	$bench -label pool -rate $rate -duration $duration -warmup 1 \
+		runrootless run --pool --bundle $bundle >>$out
+	runrootless pool drain --bundle $bundle >/dev/null
+done
+
+set +x
+echo "Results: $out"
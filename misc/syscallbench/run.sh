@@ -0,0 +1,68 @@
+#!/bin/sh
+# Usage: ./run.sh [MODE...] [-- WORKLOAD_FLAGS...]
+# MODE: runc, ptrace, seccomp, selective (default: all of them)
+# Results are appended to ./results/<date>.jsonl
+set -e
+cd $(dirname $0)
+
+modes=""
+while [ $# -gt 0 ]; do
+	if [ "$1" = "--" ]; then
+		shift
+		break
+	fi
+	modes="$modes $1"
+	shift
+done
+[ -z "$modes" ] && modes="runc ptrace seccomp selective"
+
+set -x
+
+## 0. Build the fixture rootfs: a single static binary, no network access required
+rm -rf bundle
+mkdir -p bundle/rootfs/tmp bundle/rootfs/proc bundle/rootfs/dev bundle/rootfs/sys results
+CGO_ENABLED=0 go build -o bundle/rootfs/workload ./workload
+
+## 1. Generate config.json for each runtime
+# plain runc needs a rootless config.json; runrootless generates one by itself
+(cd bundle && runc spec --rootless && mv config.json config-runc.json && runc spec)
+for f in bundle/config.json bundle/config-runc.json; do
+	sed -i -e 's/"readonly": true/"readonly": false/' -e 's/"terminal": true/"terminal": false/' $f
+done
+
+## 2. Run
+out=results/$(date +%Y%m%d-%H%M%S).jsonl
+for mode in $modes; do
+	args="\"\\/workload\", \"-label\", \"$mode\""
+	for a in "$@"; do
+		args="$args, \"$a\""
+	done
+	case $mode in
+	runc)
+		sed "s/\"sh\"/$args/" bundle/config-runc.json >bundle/config.json.tmp
+		mkdir -p bundle/runc && mv bundle/config.json.tmp bundle/runc/config.json
+		ln -sfn ../rootfs bundle/runc/rootfs
+		runc run --bundle bundle/runc syscallbench-$$ >>$out
+		;;
+	ptrace | seccomp)
+		mkdir -p bundle/$mode && ln -sfn ../rootfs bundle/$mode/rootfs
+		sed "s/\"sh\"/$args/" bundle/config.json >bundle/$mode/config.json
+		seccomp=0
+		[ $mode = seccomp ] && seccomp=1
+		RUNROOTLESS_SECCOMP=$seccomp runrootless run --bundle bundle/$mode syscallbench-$$ >>$out
+		;;
+	selective)
+		# no executable is listed, so the workload runs natively in the user namespace
+		mkdir -p bundle/$mode && ln -sfn ../rootfs bundle/$mode/rootfs
+		sed -e "s/\"sh\"/$args/" -e 's/"ociVersion"/"annotations": {"runrootless.proot": "selective"},\n\t"ociVersion"/' bundle/config.json >bundle/$mode/config.json
+		runrootless run --bundle bundle/$mode syscallbench-$$ >>$out
+		;;
+	*)
+		echo "unknown mode: $mode"
+		exit 1
+		;;
+	esac
+done
+
+set +x
+echo "Results: $out"
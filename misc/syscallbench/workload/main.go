@@ -0,0 +1,449 @@
+// Command workload runs syscall-heavy micro-workloads and prints one JSON
+// line per workload with the throughput and the latency percentiles of
+// every syscall it issued.
+//
+// It is meant to be executed inside a container; see ../README.md.
+package main
+
+import (
+	"archive/tar"
+	"bytes"
+	"encoding/json"
+	"flag"
+	"fmt"
+	"io"
+	"io/ioutil"
+	"os"
+	"os/exec"
+	"path/filepath"
+	"sort"
+	"strconv"
+	"syscall"
+	"time"
+)
+
+var (
+	label = flag.String("label", "", "label to include in the output, e.g. the runtime mode")
+	work  = flag.String("work", "/tmp/syscallbench", "scratch directory")
+	n     = flag.Int("n", 20000, "number of operations for stat, open and getdents")
+	procs = flag.Int("procs", 500, "number of processes for forkexec")
+	files = flag.Int("files", 2000, "number of entries for tar and dpkg")
+)
+
+var workloads = []struct {
+	name string
+	fn   func(*recorder) (int, error)
+}{
+	{"stat", statStorm},
+	{"open", openStorm},
+	{"getdents", getdentsStorm},
+	{"forkexec", forkExecLoop},
+	{"tar", tarExtract},
+	{"dpkg", dpkgReplay},
+}
+
+func main() {
+	if len(os.Args) > 1 && os.Args[1] == "noop" {
+		return
+	}
+	flag.Usage = func() {
+		fmt.Fprintf(os.Stderr, "Usage: %s [flags] [all|stat|open|getdents|forkexec|tar|dpkg]...\n", os.Args[0])
+		flag.PrintDefaults()
+	}
+	flag.Parse()
+	names := flag.Args()
+	if len(names) == 0 || (len(names) == 1 && names[0] == "all") {
+		names = nil
+		for _, w := range workloads {
+			names = append(names, w.name)
+		}
+	}
+	enc := json.NewEncoder(os.Stdout)
+	for _, name := range names {
+		res, err := run(name)
+		if err != nil {
+			fmt.Fprintf(os.Stderr, "%s: %v\n", name, err)
+			os.Exit(1)
+		}
+		enc.Encode(res)
+	}
+}
+
+type result struct {
+	Label        string                 `json:"label,omitempty"`
+	Workload     string                 `json:"workload"`
+	Ops          int                    `json:"ops"`
+	Seconds      float64                `json:"seconds"`
+	OpsPerSecond float64                `json:"opsPerSecond"`
+	Syscalls     map[string]percentiles `json:"syscalls"`
+}
+
+type percentiles struct {
+	Count  int   `json:"count"`
+	Errors int   `json:"errors"`
+	P50Ns  int64 `json:"p50Ns"`
+	P90Ns  int64 `json:"p90Ns"`
+	P99Ns  int64 `json:"p99Ns"`
+	MaxNs  int64 `json:"maxNs"`
+}
+
+func run(name string) (*result, error) {
+	for _, w := range workloads {
+		if w.name != name {
+			continue
+		}
+		if err := os.RemoveAll(*work); err != nil {
+			return nil, err
+		}
+		if err := os.MkdirAll(*work, 0755); err != nil {
+			return nil, err
+		}
+		defer os.RemoveAll(*work)
+		r := &recorder{samples: make(map[string][]time.Duration), errors: make(map[string]int)}
+		begin := time.Now()
+		ops, err := w.fn(r)
+		if err != nil {
+			return nil, err
+		}
+		elapsed := time.Since(begin)
+		res := &result{
+			Label:        *label,
+			Workload:     name,
+			Ops:          ops,
+			Seconds:      elapsed.Seconds(),
+			OpsPerSecond: float64(ops) / elapsed.Seconds(),
+			Syscalls:     make(map[string]percentiles),
+		}
+		for sc, d := range r.samples {
+			p := summarize(d)
+			p.Errors = r.errors[sc]
+			res.Syscalls[sc] = p
+		}
+		return res, nil
+	}
+	return nil, fmt.Errorf("unknown workload %q", name)
+}
+
+// recorder records the latency and the errors of each syscall issued through do.
+// Every call of do must issue exactly one syscall, so that the percentiles are per syscall.
+// Setup work that is not issued through do is not accounted.
+type recorder struct {
+	samples map[string][]time.Duration
+	errors  map[string]int
+}
+
+func (r *recorder) do(syscall string, fn func() error) error {
+	begin := time.Now()
+	err := fn()
+	r.samples[syscall] = append(r.samples[syscall], time.Since(begin))
+	if err != nil {
+		r.errors[syscall]++
+	}
+	return err
+}
+
+func summarize(d []time.Duration) percentiles {
+	sort.Slice(d, func(i, j int) bool { return d[i] < d[j] })
+	at := func(q float64) int64 {
+		return int64(d[int(q*float64(len(d)-1))])
+	}
+	return percentiles{
+		Count: len(d),
+		P50Ns: at(0.50),
+		P90Ns: at(0.90),
+		P99Ns: at(0.99),
+		MaxNs: int64(d[len(d)-1]),
+	}
+}
+
+// populate creates a tree of 20 directories with 50 files each, and returns the paths.
+func populate() ([]string, []string, error) {
+	var dirs, paths []string
+	for i := 0; i < 20; i++ {
+		dir := filepath.Join(*work, "tree", strconv.Itoa(i))
+		if err := os.MkdirAll(dir, 0755); err != nil {
+			return nil, nil, err
+		}
+		dirs = append(dirs, dir)
+		for j := 0; j < 50; j++ {
+			p := filepath.Join(dir, "file"+strconv.Itoa(j))
+			if err := ioutil.WriteFile(p, []byte(p), 0644); err != nil {
+				return nil, nil, err
+			}
+			paths = append(paths, p)
+		}
+	}
+	return dirs, paths, nil
+}
+
+func statStorm(r *recorder) (int, error) {
+	_, paths, err := populate()
+	if err != nil {
+		return 0, err
+	}
+	for i := 0; i < *n; i++ {
+		p := paths[i%len(paths)]
+		if err := r.do("lstat", func() error { _, err := os.Lstat(p); return err }); err != nil {
+			return i, err
+		}
+	}
+	return *n, nil
+}
+
+func openStorm(r *recorder) (int, error) {
+	_, paths, err := populate()
+	if err != nil {
+		return 0, err
+	}
+	for i := 0; i < *n; i++ {
+		var f *os.File
+		p := paths[i%len(paths)]
+		if err := r.do("open", func() error { f, err = os.Open(p); return err }); err != nil {
+			return i, err
+		}
+		if err := r.do("close", f.Close); err != nil {
+			return i, err
+		}
+	}
+	return *n, nil
+}
+
+func getdentsStorm(r *recorder) (int, error) {
+	dirs, _, err := populate()
+	if err != nil {
+		return 0, err
+	}
+	buf := make([]byte, 4096)
+	for i := 0; i < *n; i++ {
+		f, err := os.Open(dirs[i%len(dirs)])
+		if err != nil {
+			return i, err
+		}
+		fd := int(f.Fd())
+		for {
+			var n int
+			err = r.do("getdents", func() (err error) { n, err = syscall.Getdents(fd, buf); return err })
+			if err != nil || n == 0 {
+				break
+			}
+		}
+		f.Close()
+		if err != nil {
+			return i, err
+		}
+	}
+	return *n, nil
+}
+
+func forkExecLoop(r *recorder) (int, error) {
+	self, err := os.Executable()
+	if err != nil {
+		return 0, err
+	}
+	for i := 0; i < *procs; i++ {
+		if err := r.do("fork+execve+wait4", exec.Command(self, "noop").Run); err != nil {
+			return i, err
+		}
+	}
+	return *procs, nil
+}
+
+// tarArchive returns an archive in the layout of a typical image layer,
+// with entries owned by various users.
+func tarArchive(entries int) ([]byte, error) {
+	var buf bytes.Buffer
+	tw := tar.NewWriter(&buf)
+	for i := 0; i < entries; i++ {
+		hdr := &tar.Header{
+			Uid:     i % 3 * 1000,
+			Gid:     i % 5 * 1000,
+			ModTime: time.Unix(1500000000, 0),
+		}
+		var body []byte
+		if i%10 == 0 {
+			hdr.Typeflag = tar.TypeDir
+			hdr.Name = fmt.Sprintf("usr/share/d%d/", i/10)
+			hdr.Mode = 0755
+		} else {
+			body = bytes.Repeat([]byte{'x'}, 512+i%4096)
+			hdr.Typeflag = tar.TypeReg
+			hdr.Name = fmt.Sprintf("usr/share/d%d/f%d", i/10, i)
+			hdr.Mode = 0644
+			hdr.Size = int64(len(body))
+		}
+		if err := tw.WriteHeader(hdr); err != nil {
+			return nil, err
+		}
+		if _, err := tw.Write(body); err != nil {
+			return nil, err
+		}
+	}
+	err := tw.Close()
+	return buf.Bytes(), err
+}
+
+func tarExtract(r *recorder) (int, error) {
+	archive, err := tarArchive(*files)
+	if err != nil {
+		return 0, err
+	}
+	root := filepath.Join(*work, "rootfs")
+	tr := tar.NewReader(bytes.NewReader(archive))
+	ops := 0
+	for ; ; ops++ {
+		hdr, err := tr.Next()
+		if err == io.EOF {
+			return ops, nil
+		}
+		if err != nil {
+			return ops, err
+		}
+		p := filepath.Join(root, hdr.Name)
+		mode := os.FileMode(hdr.Mode).Perm()
+		if err := os.MkdirAll(filepath.Dir(p), 0755); err != nil {
+			return ops, err
+		}
+		switch hdr.Typeflag {
+		case tar.TypeDir:
+			if err := r.do("mkdir", func() error { return syscall.Mkdir(p, uint32(mode)) }); err != nil {
+				return ops, err
+			}
+		default:
+			body, err := ioutil.ReadAll(tr)
+			if err != nil {
+				return ops, err
+			}
+			if err := writeFile(r, p, body, os.O_TRUNC, mode); err != nil {
+				return ops, err
+			}
+		}
+		// chown is expected to fail without root emulation; it is counted in "errors".
+		r.do("lchown", func() error { return os.Lchown(p, hdr.Uid, hdr.Gid) })
+		if err := r.do("chmod", func() error { return os.Chmod(p, mode) }); err != nil {
+			return ops, err
+		}
+		if err := r.do("utimensat", func() error { return os.Chtimes(p, hdr.ModTime, hdr.ModTime) }); err != nil {
+			return ops, err
+		}
+	}
+}
+
+// writeFile writes data to p with open(2), a single write(2) and close(2).
+func writeFile(r *recorder, p string, data []byte, flag int, mode os.FileMode) error {
+	var f *os.File
+	err := r.do("open", func() (err error) {
+		f, err = os.OpenFile(p, os.O_CREATE|os.O_WRONLY|flag, mode)
+		return err
+	})
+	if err != nil {
+		return err
+	}
+	if err := r.do("write", func() error { _, err := f.Write(data); return err }); err != nil {
+		f.Close()
+		return err
+	}
+	return r.do("close", f.Close)
+}
+
+// readFile reads p with open(2), read(2) until EOF, and close(2).
+func readFile(r *recorder, p string) ([]byte, error) {
+	var f *os.File
+	err := r.do("open", func() (err error) { f, err = os.Open(p); return err })
+	if err != nil {
+		return nil, err
+	}
+	var data []byte
+	buf := make([]byte, 64*1024)
+	for {
+		var n int
+		eof := false
+		err := r.do("read", func() (err error) {
+			n, err = f.Read(buf)
+			if err == io.EOF {
+				eof, err = true, nil
+			}
+			return err
+		})
+		if err != nil {
+			f.Close()
+			return nil, err
+		}
+		data = append(data, buf[:n]...)
+		if eof {
+			break
+		}
+	}
+	return data, r.do("close", f.Close)
+}
+
+// dpkgReplay replays the syscall pattern of dpkg unpacking packages of 20 files each:
+// stat the target, write <file>.dpkg-new, fsync, chown, chmod, rename over the target,
+// and finally rewrite the status database.
+func dpkgReplay(r *recorder) (int, error) {
+	root := filepath.Join(*work, "rootfs")
+	status := filepath.Join(root, "var", "lib", "dpkg", "status")
+	if err := os.MkdirAll(filepath.Dir(status), 0755); err != nil {
+		return 0, err
+	}
+	if err := ioutil.WriteFile(status, nil, 0644); err != nil {
+		return 0, err
+	}
+	if err := os.MkdirAll(filepath.Join(root, "usr", "lib"), 0755); err != nil {
+		return 0, err
+	}
+	const filesPerPackage = 20
+	for i := 0; i < *files; i++ {
+		pkg := i / filesPerPackage
+		dir := filepath.Join(root, "usr", "lib", "pkg"+strconv.Itoa(pkg))
+		if i%filesPerPackage == 0 {
+			if err := r.do("mkdir", func() error { return syscall.Mkdir(dir, 0755) }); err != nil {
+				return i, err
+			}
+		}
+		p := filepath.Join(dir, "file"+strconv.Itoa(i))
+		r.do("lstat", func() error { _, err := os.Lstat(p); return err })
+		var f *os.File
+		err := r.do("open", func() (err error) {
+			f, err = os.OpenFile(p+".dpkg-new", os.O_CREATE|os.O_WRONLY|os.O_TRUNC, 0644)
+			return err
+		})
+		if err != nil {
+			return i, err
+		}
+		if err := r.do("write", func() error { _, err := f.Write(bytes.Repeat([]byte{'x'}, 1024)); return err }); err != nil {
+			return i, err
+		}
+		if err := r.do("fsync", f.Sync); err != nil {
+			return i, err
+		}
+		if err := r.do("close", f.Close); err != nil {
+			return i, err
+		}
+		r.do("lchown", func() error { return os.Lchown(p+".dpkg-new", 0, 0) })
+		if err := r.do("chmod", func() error { return os.Chmod(p+".dpkg-new", 0644) }); err != nil {
+			return i, err
+		}
+		if err := r.do("rename", func() error { return os.Rename(p+".dpkg-new", p) }); err != nil {
+			return i, err
+		}
+		if i%filesPerPackage == filesPerPackage-1 {
+			if err := rewriteStatus(r, status, pkg); err != nil {
+				return i, err
+			}
+		}
+	}
+	return *files, nil
+}
+
+func rewriteStatus(r *recorder, status string, pkg int) error {
+	old, err := readFile(r, status)
+	if err != nil {
+		return err
+	}
+	entry := fmt.Sprintf("Package: pkg%d\nStatus: install ok installed\n\n", pkg)
+	tmp := status + "-new"
+	if err := writeFile(r, tmp, append(old, entry...), os.O_TRUNC, 0644); err != nil {
+		return err
+	}
+	return r.do("rename", func() error { return os.Rename(tmp, status) })
+}
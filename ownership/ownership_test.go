@@ -0,0 +1,63 @@
+package ownership
+
+import (
+	"io/ioutil"
+	"os"
+	"path/filepath"
+	"testing"
+
+	"github.com/pkg/errors"
+	"github.com/stretchr/testify/require"
+	"golang.org/x/sys/unix"
+)
+
+func TestMarshal(t *testing.T) {
+	for _, o := range []Owner{{0, 0}, {1000, 0}, {0, 1000}, {NoopID, 42}} {
+		decoded, err := Unmarshal(o.Marshal())
+		require.NoError(t, err)
+		require.Equal(t, o, decoded)
+	}
+	// uid=1000, gid=1000, with an unknown length-delimited field 3
+	decoded, err := Unmarshal([]byte{0x08, 0xe8, 0x07, 0x1a, 0x01, 0xff, 0x10, 0xe8, 0x07})
+	require.NoError(t, err)
+	require.Equal(t, Owner{1000, 1000}, decoded)
+	_, err = Unmarshal([]byte{0x08, 0xe8})
+	require.Error(t, err)
+}
+
+func TestGetSet(t *testing.T) {
+	dir, err := ioutil.TempDir("", "runrootless-test")
+	require.NoError(t, err)
+	defer os.RemoveAll(dir)
+	p := filepath.Join(dir, "f")
+	require.NoError(t, ioutil.WriteFile(p, nil, 0644))
+
+	_, ok, err := Get(p)
+	require.NoError(t, err)
+	require.False(t, ok)
+	if err := Set(p, Owner{UID: 1000, GID: 42}); err != nil {
+		if errors.Cause(err) == unix.ENOTSUP {
+			t.Skip("user xattrs are not supported")
+		}
+		require.NoError(t, err)
+	}
+	o, ok, err := Get(p)
+	require.NoError(t, err)
+	require.True(t, ok)
+	require.Equal(t, Owner{UID: 1000, GID: 42}, o)
+
+	f, err := os.OpenFile(p, os.O_WRONLY, 0)
+	require.NoError(t, err)
+	defer f.Close()
+	require.NoError(t, SetFile(f, Owner{UID: 0, GID: 7}))
+	o, ok, err = Get(p)
+	require.NoError(t, err)
+	require.True(t, ok)
+	require.Equal(t, Owner{GID: 7}, o)
+
+	require.NoError(t, Remove(p))
+	_, ok, err = Get(p)
+	require.NoError(t, err)
+	require.False(t, ok)
+	require.NoError(t, Remove(p))
+}
@@ -0,0 +1,166 @@
+// Package ownership handles the emulated file ownership shared by PRoot and umoci
+// via the "user.rootlesscontainers" xattr.
+package ownership
+
+import (
+	"math"
+	"os"
+	"unsafe"
+
+	"github.com/pkg/errors"
+	"golang.org/x/sys/unix"
+)
+
+const (
+	// XattrName is the name of the xattr that holds the emulated ownership.
+	XattrName = "user.rootlesscontainers"
+	// NoopID means that the owner is not emulated, i.e. the real owner is used.
+	NoopID = math.MaxUint32
+)
+
+// Owner is the emulated ownership of a file.
+// The value is encoded as the rootlesscontainers.Resource protobuf message:
+// https://github.com/rootless-containers/proto
+type Owner struct {
+	UID uint32
+	GID uint32
+}
+
+// Marshal encodes o as the protobuf message.
+// Following the proto3 convention, zero fields are omitted.
+func (o Owner) Marshal() []byte {
+	var b []byte
+	if o.UID != 0 {
+		b = append(b, 1<<3)
+		b = appendVarint(b, uint64(o.UID))
+	}
+	if o.GID != 0 {
+		b = append(b, 2<<3)
+		b = appendVarint(b, uint64(o.GID))
+	}
+	return b
+}
+
+// Unmarshal decodes the protobuf message. Unknown fields are skipped.
+func Unmarshal(b []byte) (Owner, error) {
+	var o Owner
+	for len(b) > 0 {
+		tag, n := varint(b)
+		if n <= 0 {
+			return o, errors.New("malformed tag")
+		}
+		b = b[n:]
+		field, wireType := tag>>3, tag&7
+		switch wireType {
+		case 0:
+			v, n := varint(b)
+			if n <= 0 {
+				return o, errors.New("malformed varint")
+			}
+			b = b[n:]
+			switch field {
+			case 1:
+				o.UID = uint32(v)
+			case 2:
+				o.GID = uint32(v)
+			}
+		case 1:
+			if len(b) < 8 {
+				return o, errors.New("malformed fixed64")
+			}
+			b = b[8:]
+		case 2:
+			l, n := varint(b)
+			if n <= 0 || uint64(len(b)-n) < l {
+				return o, errors.New("malformed length-delimited field")
+			}
+			b = b[n+int(l):]
+		case 5:
+			if len(b) < 4 {
+				return o, errors.New("malformed fixed32")
+			}
+			b = b[4:]
+		default:
+			return o, errors.Errorf("unsupported wire type %d", wireType)
+		}
+	}
+	return o, nil
+}
+
+func appendVarint(b []byte, v uint64) []byte {
+	for v >= 0x80 {
+		b = append(b, byte(v)|0x80)
+		v >>= 7
+	}
+	return append(b, byte(v))
+}
+
+// varint returns the decoded value and the number of bytes consumed (0 on error).
+func varint(b []byte) (uint64, int) {
+	var v uint64
+	for i := 0; i < len(b) && i < 10; i++ {
+		v |= uint64(b[i]&0x7f) << (7 * uint(i))
+		if b[i] < 0x80 {
+			return v, i + 1
+		}
+	}
+	return 0, 0
+}
+
+// Get returns the emulated ownership of path, without following symlinks.
+// ok is false if path has no emulated ownership.
+func Get(path string) (o Owner, ok bool, err error) {
+	buf := make([]byte, 64)
+	n, err := unix.Lgetxattr(path, XattrName, buf)
+	switch err {
+	case nil:
+	case unix.ENODATA, unix.ENOTSUP:
+		return o, false, nil
+	default:
+		return o, false, errors.Wrapf(err, "lgetxattr %s", path)
+	}
+	o, err = Unmarshal(buf[:n])
+	if err != nil {
+		return o, false, errors.Wrapf(err, "%s of %s", XattrName, path)
+	}
+	return o, true, nil
+}
+
+// Set sets the emulated ownership of path, without following symlinks.
+func Set(path string, o Owner) error {
+	if err := unix.Lsetxattr(path, XattrName, o.Marshal(), 0); err != nil {
+		return errors.Wrapf(err, "lsetxattr %s", path)
+	}
+	return nil
+}
+
+// SetFile sets the emulated ownership of the open file f.
+func SetFile(f *os.File, o Owner) error {
+	// x/sys/unix does not provide fsetxattr(2) on Linux
+	name, err := unix.BytePtrFromString(XattrName)
+	if err != nil {
+		return err
+	}
+	b := o.Marshal()
+	var value unsafe.Pointer
+	if len(b) > 0 {
+		value = unsafe.Pointer(&b[0])
+	}
+	_, _, errno := unix.Syscall6(unix.SYS_FSETXATTR, f.Fd(), uintptr(unsafe.Pointer(name)),
+		uintptr(value), uintptr(len(b)), 0, 0)
+	if errno != 0 {
+		return errors.Wrapf(errno, "fsetxattr %s", f.Name())
+	}
+	return nil
+}
+
+// Remove removes the emulated ownership of path, without following symlinks.
+// It is not an error if path has no emulated ownership.
+func Remove(path string) error {
+	switch err := unix.Lremovexattr(path, XattrName); err {
+	case nil, unix.ENODATA, unix.ENOTSUP:
+		return nil
+	default:
+		return errors.Wrapf(err, "lremovexattr %s", path)
+	}
+}
@@ -0,0 +1,427 @@
+package main
+
+import (
+	"bytes"
+	"crypto/rand"
+	"encoding/hex"
+	"encoding/json"
+	"fmt"
+	"io/ioutil"
+	"os"
+	"os/exec"
+	"path/filepath"
+	"strconv"
+	"strings"
+	"syscall"
+	"text/tabwriter"
+	"time"
+
+	"github.com/opencontainers/runtime-spec/specs-go"
+	"github.com/pkg/errors"
+	"github.com/rootless-containers/runrootless/agent"
+	"github.com/rootless-containers/runrootless/bundle"
+	"github.com/rootless-containers/runrootless/pool"
+	"github.com/sirupsen/logrus"
+	"github.com/urfave/cli"
+)
+
+// poolIDPrefix is the prefix of the ids of the containers of 'run --pool', whether parked or created as the pool was empty.
+const poolIDPrefix = "runrootless-pool-"
+
+var poolBundleFlag = cli.StringFlag{
+	Name:  "bundle, b",
+	Value: "",
+	Usage: `path to the root of the bundle directory, defaults to the current directory`,
+}
+
+var poolCommand = cli.Command{
+	Name:  "pool",
+	Usage: "manage the containers parked for a bundle (see 'run --pool')",
+	Subcommands: []cli.Command{
+		{
+			Name:  "fill",
+			Usage: "create and park containers until the pool is full",
+			Flags: []cli.Flag{
+				poolBundleFlag,
+				cli.IntFlag{
+					Name:  "size, n",
+					Value: -1,
+					Usage: "number of containers to keep parked, defaults to the previous value",
+				},
+			},
+			Action: poolFill,
+		},
+		{
+			Name:   "ls",
+			Usage:  "list the parked containers",
+			Flags:  []cli.Flag{poolBundleFlag},
+			Action: poolList,
+		},
+		{
+			Name:   "drain",
+			Usage:  "delete the parked containers, and stop refilling the pool",
+			Flags:  []cli.Flag{poolBundleFlag},
+			Action: poolDrain,
+		},
+	},
+}
+
+// agentCommand is executed in the container, under PRoot.
+var agentCommand = cli.Command{
+	Name:            "agent",
+	Usage:           "run processes in the container on behalf of runrootless (internal)",
+	ArgsUsage:       `<socket> [-- <command> [args...]]`,
+	Hidden:          true,
+	SkipFlagParsing: true,
+	Action:          runAgent,
+}
+
+// runAgent serves the requests on the socket, and exits with the status of the main process.
+// The main process is the command after "--", or the first request if not specified.
+func runAgent(context *cli.Context) error {
+	args := context.Args()
+	if len(args) == 0 || args[0] == "" {
+		return errors.New("socket cannot be empty")
+	}
+	var main *agent.Request
+	if len(args) > 1 {
+		if args[1] != "--" || len(args) < 3 {
+			return errors.Errorf("unexpected arguments: %v", args[1:])
+		}
+		cwd, err := os.Getwd()
+		if err != nil {
+			return err
+		}
+		main = &agent.Request{Args: args[2:], Env: os.Environ(), Cwd: cwd}
+	}
+	code, err := agent.Serve(args[0], main)
+	if err != nil {
+		return err
+	}
+	os.Exit(code)
+	return nil
+}
+
+func openPool(context *cli.Context) (*pool.Pool, string, error) {
+	bundleDir, err := resolveBundleDir(context)
+	if err != nil {
+		return nil, "", err
+	}
+	bundleDir, err = filepath.Abs(bundleDir)
+	if err != nil {
+		return nil, "", err
+	}
+	p, err := pool.Open(bundleDir)
+	return p, bundleDir, err
+}
+
+func poolFill(context *cli.Context) error {
+	p, bundleDir, err := openPool(context)
+	if err != nil {
+		return err
+	}
+	unlock, err := p.Lock()
+	if err != nil {
+		return err
+	}
+	defer unlock()
+	if n := context.Int("size"); n >= 0 {
+		if err := p.SetSize(n); err != nil {
+			return err
+		}
+	}
+	size, err := p.Size()
+	if err != nil {
+		return err
+	}
+	if _, err := reapClaimed(p); err != nil {
+		return err
+	}
+	key, err := bundle.Key(bundleDir, bundle.AgentPool)
+	if err != nil {
+		return err
+	}
+	ready, err := discardStale(p, key)
+	if err != nil {
+		return err
+	}
+	for i := ready; i < size; i++ {
+		e, err := park(context, bundleDir, key)
+		if err != nil {
+			return err
+		}
+		if err := p.Park(*e); err != nil {
+			return err
+		}
+		logrus.Debugf("parked %s (pid %d)", e.ID, e.Pid)
+	}
+	return nil
+}
+
+func poolList(context *cli.Context) error {
+	p, _, err := openPool(context)
+	if err != nil {
+		return err
+	}
+	ready, err := p.Ready()
+	if err != nil {
+		return err
+	}
+	w := tabwriter.NewWriter(context.App.Writer, 12, 1, 3, ' ', 0)
+	fmt.Fprint(w, "ID\tPID\tROOT\n")
+	for _, e := range ready {
+		fmt.Fprintf(w, "%s\t%d\t%s\n", e.ID, e.Pid, e.Root)
+	}
+	return w.Flush()
+}
+
+func poolDrain(context *cli.Context) error {
+	p, _, err := openPool(context)
+	if err != nil {
+		return err
+	}
+	unlock, err := p.Lock()
+	if err != nil {
+		return err
+	}
+	defer unlock()
+	if err := p.SetSize(0); err != nil {
+		return err
+	}
+	reaped, err := reapClaimed(p)
+	for _, id := range reaped {
+		fmt.Fprintln(context.App.Writer, id)
+	}
+	if err != nil {
+		return err
+	}
+	for {
+		e, err := p.Claim()
+		if err != nil {
+			return err
+		}
+		if e == nil {
+			return nil
+		}
+		if err := deletePooled(p, e); err != nil {
+			return err
+		}
+		fmt.Fprintln(context.App.Writer, e.ID)
+	}
+}
+
+// discardStale deletes the parked containers whose key is not key, as they were created
+// from a previous version of the bundle. It returns the number of the remaining ones.
+func discardStale(p *pool.Pool, key string) (int, error) {
+	ready, err := p.Ready()
+	if err != nil {
+		return 0, err
+	}
+	n := 0
+	for _, e := range ready {
+		if e.Key == key {
+			n++
+			continue
+		}
+		claimed, err := p.ClaimID(e.ID)
+		if err != nil {
+			return n, err
+		}
+		if claimed == nil {
+			continue
+		}
+		logrus.Debugf("discarding stale parked container %s", e.ID)
+		if err := deletePooled(p, claimed); err != nil {
+			return n, err
+		}
+	}
+	return n, nil
+}
+
+// reapClaimed deletes the claimed containers whose process has exited, but which were not
+// deleted as 'run' did not finish, e.g. as it was killed. It returns their ids.
+// The containers that are still running are left alone.
+func reapClaimed(p *pool.Pool) ([]string, error) {
+	claimed, err := p.Claimed()
+	if err != nil {
+		return nil, err
+	}
+	var reaped []string
+	for _, e := range claimed {
+		if _, err := os.Stat(filepath.Join("/proc", strconv.Itoa(e.Pid))); err == nil {
+			continue
+		}
+		if err := deletePooled(p, &e); err != nil {
+			// the state of the container may be gone already
+			logrus.Debug(err)
+			if err := p.Release(e.ID); err != nil {
+				return reaped, err
+			}
+		}
+		reaped = append(reaped, e.ID)
+	}
+	return reaped, nil
+}
+
+// park creates a container for bundleDir whose process is the agent, starts it,
+// and waits for the agent to listen.
+// The container goes through the same Transform as create, with bundle.AgentPool.
+// key is the current cache key of the bundle, which is recorded in the entry.
+func park(context *cli.Context, bundleDir, key string) (*pool.Entry, error) {
+	root := context.GlobalString("root")
+	id, err := poolID()
+	if err != nil {
+		return nil, err
+	}
+	newBundleDir, err := bundle.Transform(cacheDir(bundleDir), bundleDir, filepath.Join(root, id), bundle.AgentPool)
+	if err != nil {
+		return nil, err
+	}
+	// The stdio of runc is inherited by the agent, so it must not be a pipe that we wait for.
+	// The job gets the stdio of 'run' instead.
+	create := exec.Command(runc, append(runcGlobalArgs(context), "create", "--bundle", newBundleDir, id)...)
+	if err := create.Run(); err != nil {
+		return nil, errors.Wrapf(err, "runc create %s", id)
+	}
+	if err := runcQuiet(context, "start", id); err != nil {
+		runcQuiet(context, "delete", "-f", id)
+		return nil, err
+	}
+	pid, err := containerPid(context, id)
+	if err == nil {
+		err = waitAgent(pid, 10*time.Second)
+	}
+	if err != nil {
+		runcQuiet(context, "delete", "-f", id)
+		return nil, err
+	}
+	return &pool.Entry{ID: id, Root: root, Pid: pid, Key: key}, nil
+}
+
+func poolID() (string, error) {
+	b := make([]byte, 8)
+	if _, err := rand.Read(b); err != nil {
+		return "", err
+	}
+	return poolIDPrefix + hex.EncodeToString(b), nil
+}
+
+// waitAgent waits for the agent in the container to listen.
+func waitAgent(pid int, timeout time.Duration) error {
+	sock := agent.SocketPath(pid)
+	for deadline := time.Now().Add(timeout); time.Now().Before(deadline); time.Sleep(5 * time.Millisecond) {
+		if _, err := os.Stat(sock); err == nil {
+			return nil
+		}
+		if _, err := os.Stat(filepath.Join("/proc", strconv.Itoa(pid))); err != nil {
+			return errors.Errorf("the agent of the container (pid %d) exited", pid)
+		}
+	}
+	return errors.Errorf("timed out waiting for %s", sock)
+}
+
+// runcQuiet runs runc with the stderr captured into the error.
+func runcQuiet(context *cli.Context, args ...string) error {
+	args = append(runcGlobalArgs(context), args...)
+	var stderr bytes.Buffer
+	cmd := exec.Command(runc, args...)
+	cmd.Stderr = &stderr
+	if err := cmd.Run(); err != nil {
+		return errors.Errorf("runc %s: %v: %s", strings.Join(args, " "), err, strings.TrimSpace(stderr.String()))
+	}
+	return nil
+}
+
+func deletePooled(p *pool.Pool, e *pool.Entry) error {
+	var stderr bytes.Buffer
+	cmd := exec.Command(runc, "--root", e.Root, "delete", "-f", e.ID)
+	cmd.Stderr = &stderr
+	if err := cmd.Run(); err != nil {
+		return errors.Errorf("runc delete %s: %v: %s", e.ID, err, strings.TrimSpace(stderr.String()))
+	}
+	return p.Release(e.ID)
+}
+
+// runPooled runs the process of bundleDir in a parked container, and refills the pool in background.
+// ok is false if the pool is empty.
+func runPooled(context *cli.Context, bundleDir string) (ok bool, err error) {
+	p, err := pool.Open(bundleDir)
+	if err != nil {
+		return false, err
+	}
+	defer refillPool(context, p, bundleDir)
+	proc, err := readProcess(bundleDir)
+	if err != nil {
+		return false, err
+	}
+	key, err := bundle.Key(bundleDir, bundle.AgentPool)
+	if err != nil {
+		return false, err
+	}
+	for {
+		e, err := p.Claim()
+		if err != nil || e == nil {
+			return false, err
+		}
+		if e.Key != key {
+			// the bundle, PRoot or runrootless has changed since the container was parked
+			logrus.Debugf("discarding stale parked container %s", e.ID)
+			deletePooled(p, e)
+			continue
+		}
+		sock := agent.SocketPath(e.Pid)
+		if _, err := os.Stat(sock); err != nil {
+			logrus.Debugf("discarding stale parked container %s: %v", e.ID, err)
+			deletePooled(p, e)
+			continue
+		}
+		logrus.Debugf("claimed parked container %s", e.ID)
+		req := &agent.Request{Args: proc.Args, Env: proc.Env, Cwd: proc.Cwd}
+		code, err := agent.Run(sock, req, [3]*os.File{os.Stdin, os.Stdout, os.Stderr})
+		if delErr := deletePooled(p, e); delErr != nil {
+			logrus.Warn(delErr)
+		}
+		if err != nil {
+			return true, err
+		}
+		if code != 0 {
+			return true, cli.NewExitError("", code)
+		}
+		return true, nil
+	}
+}
+
+// readProcess reads the process from config.json of the bundle.
+func readProcess(bundleDir string) (*specs.Process, error) {
+	b, err := ioutil.ReadFile(filepath.Join(bundleDir, "config.json"))
+	if err != nil {
+		return nil, err
+	}
+	var spec specs.Spec
+	if err := json.Unmarshal(b, &spec); err != nil {
+		return nil, err
+	}
+	if spec.Process == nil {
+		return nil, errors.New("process is not set in config.json")
+	}
+	return spec.Process, nil
+}
+
+// refillPool spawns 'runrootless pool fill' in background, unless the pool has no size.
+func refillPool(context *cli.Context, p *pool.Pool, bundleDir string) {
+	if size, err := p.Size(); err != nil || size == 0 {
+		return
+	}
+	self, err := os.Executable()
+	if err != nil {
+		logrus.Warn(err)
+		return
+	}
+	cmd := exec.Command(self, "--root", context.GlobalString("root"), "pool", "fill", "--bundle", bundleDir)
+	cmd.SysProcAttr = &syscall.SysProcAttr{Setsid: true}
+	if err := cmd.Start(); err != nil {
+		logrus.Warn(err)
+		return
+	}
+	cmd.Process.Release()
+}
@@ -0,0 +1,198 @@
+// Package pool keeps track of the containers that are parked for a bundle, ready to be claimed.
+//
+//	~/.runrootless/pools/<hash>/bundle          the absolute path of the bundle
+//	~/.runrootless/pools/<hash>/size            the number of containers to keep parked
+//	~/.runrootless/pools/<hash>/lock            serializes the refills
+//	~/.runrootless/pools/<hash>/<id>.ready      a parked container
+//	~/.runrootless/pools/<hash>/<id>.claimed    a container that has been claimed, until it is deleted
+//
+// A container is claimed by renaming its .ready file, so that it is claimed at most once
+// even by concurrent invocations.
+package pool
+
+import (
+	"crypto/sha256"
+	"encoding/hex"
+	"encoding/json"
+	"io/ioutil"
+	"os"
+	"path/filepath"
+	"strconv"
+	"strings"
+	"syscall"
+
+	"github.com/pkg/errors"
+	"github.com/rootless-containers/runrootless/base"
+)
+
+const (
+	readySuffix   = ".ready"
+	claimedSuffix = ".claimed"
+)
+
+// Entry is a parked container.
+type Entry struct {
+	ID string `json:"id"`
+	// Root is the runc state root of the container.
+	Root string `json:"root"`
+	// Pid is the pid of the init process of the container.
+	Pid int `json:"pid"`
+	// Key is the cache key of the transformed bundle the container was created from.
+	// A container with a different key than the current one is stale.
+	Key string `json:"key"`
+}
+
+// Pool is the pool of a bundle.
+type Pool struct {
+	dir string
+}
+
+// Open opens the pool of the bundle, creating it if needed.
+func Open(bundle string) (*Pool, error) {
+	bundle, err := filepath.Abs(bundle)
+	if err != nil {
+		return nil, err
+	}
+	h := sha256.Sum256([]byte(bundle))
+	dir := filepath.Join(base.Dir(), "pools", hex.EncodeToString(h[:8]))
+	if err := os.MkdirAll(dir, 0700); err != nil {
+		return nil, err
+	}
+	if err := ioutil.WriteFile(filepath.Join(dir, "bundle"), []byte(bundle+"\n"), 0600); err != nil {
+		return nil, err
+	}
+	return &Pool{dir: dir}, nil
+}
+
+// Lock takes the exclusive lock of the pool, and returns the function to release it.
+// The lock is released as well when the process exits.
+func (p *Pool) Lock() (func(), error) {
+	f, err := os.OpenFile(filepath.Join(p.dir, "lock"), os.O_RDWR|os.O_CREATE, 0600)
+	if err != nil {
+		return nil, err
+	}
+	if err := syscall.Flock(int(f.Fd()), syscall.LOCK_EX); err != nil {
+		f.Close()
+		return nil, err
+	}
+	return func() { f.Close() }, nil
+}
+
+// Size returns the number of containers to keep parked, 0 if not set.
+func (p *Pool) Size() (int, error) {
+	b, err := ioutil.ReadFile(filepath.Join(p.dir, "size"))
+	if os.IsNotExist(err) {
+		return 0, nil
+	}
+	if err != nil {
+		return 0, err
+	}
+	return strconv.Atoi(strings.TrimSpace(string(b)))
+}
+
+// SetSize sets the number of containers to keep parked.
+func (p *Pool) SetSize(n int) error {
+	if n < 0 {
+		return errors.Errorf("invalid size: %d", n)
+	}
+	return ioutil.WriteFile(filepath.Join(p.dir, "size"), []byte(strconv.Itoa(n)+"\n"), 0600)
+}
+
+// Ready returns the parked containers.
+func (p *Pool) Ready() ([]Entry, error) {
+	return p.list(readySuffix)
+}
+
+// Claimed returns the containers that have been claimed but not released.
+func (p *Pool) Claimed() ([]Entry, error) {
+	return p.list(claimedSuffix)
+}
+
+func (p *Pool) list(suffix string) ([]Entry, error) {
+	fis, err := ioutil.ReadDir(p.dir)
+	if err != nil {
+		return nil, err
+	}
+	var entries []Entry
+	for _, fi := range fis {
+		if !strings.HasSuffix(fi.Name(), suffix) {
+			continue
+		}
+		e, err := readEntry(filepath.Join(p.dir, fi.Name()))
+		if os.IsNotExist(err) {
+			// claimed concurrently
+			continue
+		}
+		if err != nil {
+			return nil, err
+		}
+		entries = append(entries, *e)
+	}
+	return entries, nil
+}
+
+// Park adds the container to the pool.
+func (p *Pool) Park(e Entry) error {
+	data, err := json.Marshal(e)
+	if err != nil {
+		return err
+	}
+	tmp := filepath.Join(p.dir, e.ID+".tmp")
+	if err := ioutil.WriteFile(tmp, data, 0600); err != nil {
+		return err
+	}
+	return os.Rename(tmp, filepath.Join(p.dir, e.ID+readySuffix))
+}
+
+// Claim claims a parked container. It returns nil if there is none.
+func (p *Pool) Claim() (*Entry, error) {
+	fis, err := ioutil.ReadDir(p.dir)
+	if err != nil {
+		return nil, err
+	}
+	for _, fi := range fis {
+		name := fi.Name()
+		if !strings.HasSuffix(name, readySuffix) {
+			continue
+		}
+		e, err := p.ClaimID(strings.TrimSuffix(name, readySuffix))
+		if err != nil || e != nil {
+			return e, err
+		}
+	}
+	return nil, nil
+}
+
+// ClaimID claims the parked container with the id. It returns nil if it has been claimed already.
+func (p *Pool) ClaimID(id string) (*Entry, error) {
+	claimed := filepath.Join(p.dir, id+claimedSuffix)
+	if err := os.Rename(filepath.Join(p.dir, id+readySuffix), claimed); err != nil {
+		if os.IsNotExist(err) {
+			// claimed concurrently
+			return nil, nil
+		}
+		return nil, err
+	}
+	return readEntry(claimed)
+}
+
+// Release removes the claimed container from the pool.
+func (p *Pool) Release(id string) error {
+	err := os.Remove(filepath.Join(p.dir, id+claimedSuffix))
+	if os.IsNotExist(err) {
+		return nil
+	}
+	return err
+}
+
+func readEntry(path string) (*Entry, error) {
+	b, err := ioutil.ReadFile(path)
+	if err != nil {
+		return nil, err
+	}
+	var e Entry
+	if err := json.Unmarshal(b, &e); err != nil {
+		return nil, errors.Wrap(err, path)
+	}
+	return &e, nil
+}
@@ -0,0 +1,89 @@
+package pool
+
+import (
+	"fmt"
+	"io/ioutil"
+	"os"
+	"sync"
+	"testing"
+
+	"github.com/stretchr/testify/require"
+)
+
+func TestClaim(t *testing.T) {
+	home, err := ioutil.TempDir("", "runrootless-pool-test")
+	require.NoError(t, err)
+	defer os.RemoveAll(home)
+	oldHome := os.Getenv("HOME")
+	os.Setenv("HOME", home)
+	defer os.Setenv("HOME", oldHome)
+
+	p, err := Open("/some/bundle")
+	require.NoError(t, err)
+	size, err := p.Size()
+	require.NoError(t, err)
+	require.Equal(t, 0, size)
+	require.NoError(t, p.SetSize(4))
+	size, err = p.Size()
+	require.NoError(t, err)
+	require.Equal(t, 4, size)
+
+	const n = 16
+	for i := 0; i < n; i++ {
+		require.NoError(t, p.Park(Entry{ID: fmt.Sprintf("c%d", i), Root: "/run/runc", Pid: 1000 + i}))
+	}
+	ready, err := p.Ready()
+	require.NoError(t, err)
+	require.Len(t, ready, n)
+
+	// concurrent claims never get the same container
+	var (
+		mu      sync.Mutex
+		claimed = make(map[string]bool)
+		wg      sync.WaitGroup
+	)
+	for i := 0; i < 2*n; i++ {
+		wg.Add(1)
+		go func() {
+			defer wg.Done()
+			e, err := p.Claim()
+			require.NoError(t, err)
+			if e == nil {
+				return
+			}
+			mu.Lock()
+			defer mu.Unlock()
+			require.False(t, claimed[e.ID], e.ID)
+			claimed[e.ID] = true
+		}()
+	}
+	wg.Wait()
+	require.Len(t, claimed, n)
+
+	ready, err = p.Ready()
+	require.NoError(t, err)
+	require.Empty(t, ready)
+	e, err := p.Claim()
+	require.NoError(t, err)
+	require.Nil(t, e)
+
+	// a container can be claimed by id, once
+	require.NoError(t, p.Park(Entry{ID: "stale", Root: "/run/runc", Pid: 999, Key: "old"}))
+	e, err = p.ClaimID("stale")
+	require.NoError(t, err)
+	require.Equal(t, &Entry{ID: "stale", Root: "/run/runc", Pid: 999, Key: "old"}, e)
+	e, err = p.ClaimID("stale")
+	require.NoError(t, err)
+	require.Nil(t, e)
+	claimed["stale"] = true
+	left, err := p.Claimed()
+	require.NoError(t, err)
+	require.Len(t, left, n+1)
+
+	for id := range claimed {
+		require.NoError(t, p.Release(id))
+	}
+	left, err = p.Claimed()
+	require.NoError(t, err)
+	require.Empty(t, left)
+}
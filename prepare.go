@@ -0,0 +1,44 @@
+package main
+
+import (
+	"runtime"
+
+	"github.com/pkg/errors"
+	"github.com/rootless-containers/runrootless/image"
+	"github.com/urfave/cli"
+)
+
+var prepareCommand = cli.Command{
+	Name:      "prepare",
+	Usage:     "create a bundle from an image in the OCI image layout",
+	ArgsUsage: `<oci-layout> <bundle>`,
+	Flags: []cli.Flag{
+		cli.StringFlag{
+			Name:  "ref",
+			Value: "",
+			Usage: "name of the image in the layout (org.opencontainers.image.ref.name), can be omitted if the layout contains only one image",
+		},
+		cli.IntFlag{
+			Name:  "jobs, j",
+			Value: runtime.NumCPU(),
+			Usage: "number of layers decompressed and of files written concurrently",
+		},
+		cli.BoolFlag{
+			Name:  "base",
+			Usage: "unpack into a base rootfs shared by the containers of the same image, instead of <bundle>/rootfs",
+		},
+	},
+	Action: prepare,
+}
+
+func prepare(context *cli.Context) error {
+	if context.NArg() != 2 {
+		return errors.New("prepare requires exactly 2 arguments: <oci-layout> <bundle>")
+	}
+	layout, bundleDir := context.Args().Get(0), context.Args().Get(1)
+	return image.Prepare(bundleDir, image.Layout(layout), image.PrepareOptions{
+		Ref:  context.String("ref"),
+		Jobs: context.Int("jobs"),
+		Base: context.Bool("base"),
+	})
+}
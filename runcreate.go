@@ -5,15 +5,20 @@ import (
 	"path/filepath"
 	"strings"
 
+	"github.com/pkg/errors"
 	"github.com/rootless-containers/runrootless/bundle"
 	"github.com/sirupsen/logrus"
 	"github.com/urfave/cli"
 )
 
 var runCommand = cli.Command{
-	Name:   "run",
-	Usage:  "create and run a container",
-	Flags:  runcRunFlags(),
+	Name:  "run",
+	Usage: "create and run a container",
+	Flags: append(runcRunFlags(),
+		cli.BoolFlag{
+			Name:  "pool",
+			Usage: "run the process in a container parked by 'pool fill', if any (without a container id)",
+		}),
 	Action: runCreate,
 }
 
@@ -25,23 +30,53 @@ var createCommand = cli.Command{
 }
 
 func runCreate(context *cli.Context) error {
-	var err error
-	bundleDir := context.String("bundle")
-	if bundleDir == "" {
-		bundleDir, err = os.Getwd()
-		if err != nil {
+	bundleDir, err := resolveBundleDir(context)
+	if err != nil {
+		return err
+	}
+	id := context.Args().First()
+	var extraArgs []string
+	if context.Bool("pool") && !context.Bool("detach") {
+		// The parked containers cannot be renamed, and runc would not find them by another id.
+		if id != "" {
+			return errors.Errorf("container id %q cannot be used with --pool, as the process runs in a parked container", id)
+		}
+		ok, err := runPooled(context, bundleDir)
+		if ok || err != nil {
+			return err
+		}
+		logrus.Debugf("no parked container for %s", bundleDir)
+		if id, err = poolID(); err != nil {
 			return err
 		}
+		extraArgs = append(extraArgs, id)
 	}
-	newBundleDir := filepath.Join(bundleDir, "runrootless")
-	logrus.Debugf("bundle: %s -> %s", bundleDir, newBundleDir)
-	if err := bundle.Transform(newBundleDir, bundleDir); err != nil {
+	container := ""
+	if id != "" {
+		container = filepath.Join(context.GlobalString("root"), id)
+	}
+	newBundleDir, err := bundle.Transform(cacheDir(bundleDir), bundleDir, container, bundle.AgentModeFromEnv())
+	if err != nil {
 		return err
 	}
-	redirectToRunc(transformRunCreate(newBundleDir)...)
+	logrus.Debugf("bundle: %s -> %s", bundleDir, newBundleDir)
+	launchRunc(append(transformRunCreate(newBundleDir), extraArgs...)...)
 	return nil
 }
 
+// resolveBundleDir returns the value of the --bundle flag, defaulting to the current directory.
+func resolveBundleDir(context *cli.Context) (string, error) {
+	if s := context.String("bundle"); s != "" {
+		return s, nil
+	}
+	return os.Getwd()
+}
+
+// cacheDir returns the directory that holds the transformed variants of bundleDir.
+func cacheDir(bundleDir string) string {
+	return filepath.Join(bundleDir, "runrootless")
+}
+
 // transformRunCreate transforms os.Args for the new bundle.
 // e.g. "runc --root /foo run --bundle /bar baz" -> {"--root", "/foo", "run", "baz", "--bundle", newBundle}
 func transformRunCreate(newBundle string) []string {
@@ -61,6 +96,9 @@ func _transformRunCreate(osArgs []string, newBundle string) []string {
 			runCreate = true
 		}
 		if runCreate {
+			if s == "--pool" || strings.HasPrefix(s, "--pool=") {
+				continue
+			}
 			if s == "-b" || s == "--bundle" {
 				skipNext = true
 				continue
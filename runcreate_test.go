@@ -1,6 +1,11 @@
 package main
 
 import (
+	"io/ioutil"
+	"os"
+	"os/exec"
+	"path/filepath"
+	"strings"
 	"testing"
 
 	"github.com/stretchr/testify/require"
@@ -24,6 +29,10 @@ func TestTransformRunCreate(t *testing.T) {
 			osArgs:   []string{"runc", "--root", "/foo", "run", "baz"},
 			expected: []string{"--root", "/foo", "run", "baz", "--bundle", newBundle},
 		},
+		{
+			osArgs:   []string{"runc", "--root", "/foo", "run", "--pool", "-b", "/bar", "baz"},
+			expected: []string{"--root", "/foo", "run", "baz", "--bundle", newBundle},
+		},
 		{
 			osArgs:   []string{"runc", "--root", "/foo", "list"},
 			expected: []string{"--root", "/foo", "list"},
@@ -35,3 +44,36 @@ func TestTransformRunCreate(t *testing.T) {
 		require.Equal(t, c.expected, actual)
 	}
 }
+
+// TestRunPoolID checks that 'run --pool' rejects a container id, and generates one if the pool is empty.
+func TestRunPoolID(t *testing.T) {
+	dir, err := ioutil.TempDir("", "runrootless-test")
+	require.NoError(t, err)
+	defer os.RemoveAll(dir)
+	home := filepath.Join(dir, "home")
+	require.NoError(t, os.MkdirAll(filepath.Join(home, ".runrootless"), 0755))
+	require.NoError(t, ioutil.WriteFile(filepath.Join(home, ".runrootless", "runrootless-proot"), nil, 0755))
+	bundleDir := filepath.Join(dir, "bundle")
+	require.NoError(t, os.MkdirAll(filepath.Join(bundleDir, "rootfs"), 0755))
+	require.NoError(t, ioutil.WriteFile(filepath.Join(bundleDir, "config.json"),
+		[]byte(`{"ociVersion": "1.0.0", "process": {"args": ["true"], "cwd": "/"}, "root": {"path": "rootfs"}, "linux": {}}`), 0644))
+	// the fake runc prints its arguments
+	bin := filepath.Join(dir, "bin")
+	require.NoError(t, os.MkdirAll(bin, 0755))
+	require.NoError(t, ioutil.WriteFile(filepath.Join(bin, runc), []byte("#!/bin/sh\necho \"$@\"\n"), 0755))
+	env := append(os.Environ(), "RUNROOTLESS_TEST_MAIN=exec", "HOME="+home, "PATH="+bin+":"+os.Getenv("PATH"))
+
+	cmd := exec.Command(os.Args[0], "--root", filepath.Join(dir, "state"), "run", "--pool", "--bundle", bundleDir, "job1")
+	cmd.Env = env
+	out, err := cmd.CombinedOutput()
+	require.Error(t, err)
+	require.Contains(t, string(out), `container id "job1" cannot be used with --pool`)
+
+	cmd = exec.Command(os.Args[0], "--root", filepath.Join(dir, "state"), "run", "--pool", "--bundle", bundleDir)
+	cmd.Env = env
+	out, err = cmd.CombinedOutput()
+	require.NoError(t, err, string(out))
+	args := strings.Fields(string(out))
+	require.True(t, strings.HasPrefix(args[len(args)-1], poolIDPrefix), string(out))
+	require.Equal(t, "--bundle", args[len(args)-3])
+}
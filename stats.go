@@ -0,0 +1,291 @@
+package main
+
+import (
+	"encoding/json"
+	"fmt"
+	"io/ioutil"
+	"os"
+	"os/exec"
+	"path/filepath"
+	"strconv"
+	"strings"
+	"syscall"
+
+	"github.com/pkg/errors"
+	"github.com/urfave/cli"
+)
+
+// clockTicks is USER_HZ, the unit of the CPU times in /proc/<pid>/stat.
+// It is 100 on every Linux architecture supported by runc.
+const clockTicks = 100
+
+var statsCommand = cli.Command{
+	Name:      "stats",
+	Usage:     "display the resource usage of the PRoot tracers of a container and their tracees in JSON (from /proc, not from PRoot)",
+	ArgsUsage: `<container-id>`,
+	Action:    stats,
+}
+
+// tracerStats is the output of the stats command.
+// Only the processes in the PID namespace of the container that are currently alive are accounted.
+// The counters internal to PRoot (syscalls by number, time in tracer stops, path translations,
+// emulated chown calls) are not available, as the pinned PRoot does not export them.
+type tracerStats struct {
+	ID  string `json:"id"`
+	Pid int    `json:"pid"`
+	// Tracers are the PRoot processes.
+	Tracers []procStats `json:"tracers"`
+	// Tracees is the sum over the processes traced by PRoot.
+	Tracees procStats `json:"tracees"`
+	// Untraced is the sum over the processes that are not traced.
+	Untraced procStats `json:"untraced"`
+	// PtraceTax is the ratio of the tracer CPU time to the CPU time of tracers and tracees.
+	PtraceTax float64 `json:"ptraceTax"`
+	// PRootTmpUsedBytes is the usage of the PROOT_TMP_DIR tmpfs mounted on /dev/proot.
+	PRootTmpUsedBytes uint64 `json:"prootTmpUsedBytes,omitempty"`
+}
+
+type procStats struct {
+	Pid       int     `json:"pid,omitempty"`
+	Processes int     `json:"processes"`
+	UserSec   float64 `json:"userSeconds"`
+	SystemSec float64 `json:"systemSeconds"`
+	// The context switches are the ones of the processes as reported by /proc/<pid>/status.
+	// They are not a count of the ptrace stops.
+	VoluntaryCtxSwitches    uint64 `json:"voluntaryContextSwitches"`
+	NonvoluntaryCtxSwitches uint64 `json:"nonvoluntaryContextSwitches"`
+	RSSKiB                  uint64 `json:"rssKiB"`
+
+	traced bool
+}
+
+func (s *procStats) add(o procStats) {
+	s.Processes += o.Processes
+	s.UserSec += o.UserSec
+	s.SystemSec += o.SystemSec
+	s.VoluntaryCtxSwitches += o.VoluntaryCtxSwitches
+	s.NonvoluntaryCtxSwitches += o.NonvoluntaryCtxSwitches
+	s.RSSKiB += o.RSSKiB
+}
+
+func stats(context *cli.Context) error {
+	id := context.Args().First()
+	if id == "" {
+		return errors.New("container id cannot be empty")
+	}
+	pid, err := containerPid(context, id)
+	if err != nil {
+		return err
+	}
+	st, err := collectStats(pid)
+	if err != nil {
+		return err
+	}
+	st.ID = id
+	data, err := json.MarshalIndent(st, "", "\t")
+	if err != nil {
+		return err
+	}
+	fmt.Fprintln(context.App.Writer, string(data))
+	return nil
+}
+
+// runcGlobalArgs returns the global flags to be passed to runc subcommands executed by runrootless.
+func runcGlobalArgs(context *cli.Context) []string {
+	return []string{"--root", context.GlobalString("root")}
+}
+
+// containerState is the subset of the output of 'runc state' used by runrootless.
+type containerState struct {
+	Pid    int    `json:"pid"`
+	Bundle string `json:"bundle"`
+}
+
+// getContainerState returns the state of the container, which must be running.
+func getContainerState(context *cli.Context, id string) (*containerState, error) {
+	args := append(runcGlobalArgs(context), "state", id)
+	out, err := exec.Command(runc, args...).Output()
+	if err != nil {
+		if exitErr, ok := err.(*exec.ExitError); ok {
+			return nil, errors.Errorf("runc state %s: %s", id, strings.TrimSpace(string(exitErr.Stderr)))
+		}
+		return nil, err
+	}
+	var state containerState
+	if err := json.Unmarshal(out, &state); err != nil {
+		return nil, err
+	}
+	if state.Pid == 0 {
+		return nil, errors.Errorf("container %s is not running", id)
+	}
+	return &state, nil
+}
+
+// containerPid returns the pid of the init process of the container.
+func containerPid(context *cli.Context, id string) (int, error) {
+	state, err := getContainerState(context, id)
+	if err != nil {
+		return 0, err
+	}
+	return state.Pid, nil
+}
+
+func collectStats(initPid int) (*tracerStats, error) {
+	pids, err := containerProcesses(initPid)
+	if err != nil {
+		return nil, err
+	}
+	var alive []int
+	procs := make(map[int]procStats)
+	tracers := make(map[int]bool)
+	for _, pid := range pids {
+		ps, tracerPid, err := readProcStats(pid)
+		if err != nil {
+			// the process has exited
+			continue
+		}
+		alive = append(alive, pid)
+		procs[pid] = ps
+		if tracerPid != 0 {
+			tracers[tracerPid] = true
+		}
+	}
+	st := &tracerStats{Pid: initPid}
+	var tracerSec float64
+	for _, pid := range alive {
+		ps := procs[pid]
+		switch {
+		case tracers[pid]:
+			ps.Pid = pid
+			st.Tracers = append(st.Tracers, ps)
+			tracerSec += ps.UserSec + ps.SystemSec
+		case ps.traced:
+			st.Tracees.add(ps)
+		default:
+			st.Untraced.add(ps)
+		}
+	}
+	if total := tracerSec + st.Tracees.UserSec + st.Tracees.SystemSec; total > 0 {
+		st.PtraceTax = tracerSec / total
+	}
+	var fs syscall.Statfs_t
+	if err := syscall.Statfs(fmt.Sprintf("/proc/%d/root/dev/proot", initPid), &fs); err == nil {
+		st.PRootTmpUsedBytes = (fs.Blocks - fs.Bfree) * uint64(fs.Bsize)
+	}
+	return st, nil
+}
+
+// containerProcesses returns the processes in the PID namespace of initPid, starting with initPid.
+// Unlike the descendants of init, they include the processes executed with 'runc exec',
+// which are children of the host runc process.
+// If the container shares the PID namespace of runrootless, the descendants of init are returned.
+func containerProcesses(initPid int) ([]int, error) {
+	pidns, err := os.Readlink(fmt.Sprintf("/proc/%d/ns/pid", initPid))
+	if err != nil {
+		return nil, err
+	}
+	if self, err := os.Readlink("/proc/self/ns/pid"); err != nil || self == pidns {
+		return descendants(initPid)
+	}
+	ents, err := ioutil.ReadDir("/proc")
+	if err != nil {
+		return nil, err
+	}
+	pids := []int{initPid}
+	for _, ent := range ents {
+		p, err := strconv.Atoi(ent.Name())
+		if err != nil || p == initPid {
+			continue
+		}
+		// processes of other users and the exited ones cannot be read
+		if ns, err := os.Readlink(filepath.Join("/proc", ent.Name(), "ns", "pid")); err == nil && ns == pidns {
+			pids = append(pids, p)
+		}
+	}
+	return pids, nil
+}
+
+// descendants returns pid and its descendants, in breadth-first order.
+func descendants(pid int) ([]int, error) {
+	ents, err := ioutil.ReadDir("/proc")
+	if err != nil {
+		return nil, err
+	}
+	children := make(map[int][]int)
+	for _, ent := range ents {
+		p, err := strconv.Atoi(ent.Name())
+		if err != nil {
+			continue
+		}
+		b, err := ioutil.ReadFile(filepath.Join("/proc", ent.Name(), "stat"))
+		if err != nil {
+			continue
+		}
+		fields, err := parseStat(string(b))
+		if err != nil {
+			continue
+		}
+		ppid, _ := strconv.Atoi(fields[1])
+		children[ppid] = append(children[ppid], p)
+	}
+	pids := []int{pid}
+	for i := 0; i < len(pids); i++ {
+		pids = append(pids, children[pids[i]]...)
+	}
+	return pids, nil
+}
+
+// parseStat returns the fields of /proc/<pid>/stat after the command name,
+// i.e. fields[0] is the state and fields[1] is the ppid.
+func parseStat(s string) ([]string, error) {
+	i := strings.LastIndex(s, ")")
+	if i < 0 {
+		return nil, errors.Errorf("unexpected stat: %q", s)
+	}
+	fields := strings.Fields(s[i+1:])
+	if len(fields) < 22 {
+		return nil, errors.Errorf("unexpected stat: %q", s)
+	}
+	return fields, nil
+}
+
+// readProcStats returns the statistics of pid, and the pid of its tracer (0 if not traced).
+func readProcStats(pid int) (procStats, int, error) {
+	ps := procStats{Processes: 1}
+	b, err := ioutil.ReadFile(fmt.Sprintf("/proc/%d/stat", pid))
+	if err != nil {
+		return ps, 0, err
+	}
+	fields, err := parseStat(string(b))
+	if err != nil {
+		return ps, 0, err
+	}
+	utime, _ := strconv.ParseUint(fields[11], 10, 64)
+	stime, _ := strconv.ParseUint(fields[12], 10, 64)
+	ps.UserSec = float64(utime) / clockTicks
+	ps.SystemSec = float64(stime) / clockTicks
+	rssPages, _ := strconv.ParseUint(fields[21], 10, 64)
+	ps.RSSKiB = rssPages * uint64(os.Getpagesize()) / 1024
+	b, err = ioutil.ReadFile(fmt.Sprintf("/proc/%d/status", pid))
+	if err != nil {
+		return ps, 0, err
+	}
+	tracerPid := 0
+	for _, line := range strings.Split(string(b), "\n") {
+		kv := strings.SplitN(line, ":", 2)
+		if len(kv) != 2 {
+			continue
+		}
+		v := strings.TrimSpace(kv[1])
+		switch kv[0] {
+		case "TracerPid":
+			tracerPid, _ = strconv.Atoi(v)
+			ps.traced = tracerPid != 0
+		case "voluntary_ctxt_switches":
+			ps.VoluntaryCtxSwitches, _ = strconv.ParseUint(v, 10, 64)
+		case "nonvoluntary_ctxt_switches":
+			ps.NonvoluntaryCtxSwitches, _ = strconv.ParseUint(v, 10, 64)
+		}
+	}
+	return ps, tracerPid, nil
+}
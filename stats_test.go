@@ -0,0 +1,71 @@
+package main
+
+import (
+	"os"
+	"os/exec"
+	"strconv"
+	"syscall"
+	"testing"
+	"time"
+
+	"github.com/stretchr/testify/require"
+)
+
+func TestParseStat(t *testing.T) {
+	fields, err := parseStat("42 (a) b (c)) S 1 42 42 0 -1 4194560 100 0 0 0 7 3 0 0 20 0 1 0 100 1000000 250 18446744073709551615")
+	require.NoError(t, err)
+	require.Equal(t, "S", fields[0])
+	require.Equal(t, "1", fields[1])
+	require.Equal(t, "7", fields[11])
+	require.Equal(t, "250", fields[21])
+
+	_, err = parseStat("42 (truncated")
+	require.Error(t, err)
+}
+
+func TestCollectStats(t *testing.T) {
+	cmd := exec.Command("sleep", "10")
+	require.NoError(t, cmd.Start())
+	defer cmd.Process.Kill()
+
+	st, err := collectStats(os.Getpid())
+	require.NoError(t, err)
+	require.Empty(t, st.Tracers)
+	require.Equal(t, 0, st.Tracees.Processes)
+	require.Equal(t, 2, st.Untraced.Processes)
+}
+
+func TestCollectStatsPIDNamespace(t *testing.T) {
+	cmd := exec.Command("sleep", "10")
+	cmd.SysProcAttr = &syscall.SysProcAttr{
+		Cloneflags:  syscall.CLONE_NEWUSER | syscall.CLONE_NEWPID,
+		UidMappings: []syscall.SysProcIDMap{{ContainerID: 0, HostID: os.Geteuid(), Size: 1}},
+		GidMappings: []syscall.SysProcIDMap{{ContainerID: 0, HostID: os.Getegid(), Size: 1}},
+	}
+	if err := cmd.Start(); err != nil {
+		t.Skipf("user namespaces are not available: %v", err)
+	}
+	defer cmd.Process.Kill()
+	// Like the processes of 'runc exec', the joined process is a child of a host process, not of init.
+	// In the proot mode of misc/startbench/exec.sh, they are the PRoot tracers of each exec.
+	pid := strconv.Itoa(cmd.Process.Pid)
+	join := exec.Command("nsenter", "-t", pid, "-U", "-p", "--preserve-credentials", "sleep", "10")
+	if err := join.Start(); err != nil {
+		t.Skipf("nsenter is not available: %v", err)
+	}
+	defer join.Process.Kill()
+	var st *tracerStats
+	for i := 0; i < 100; i++ {
+		var err error
+		st, err = collectStats(cmd.Process.Pid)
+		require.NoError(t, err)
+		if st.Untraced.Processes == 2 {
+			break
+		}
+		time.Sleep(10 * time.Millisecond)
+	}
+	require.Equal(t, 2, st.Untraced.Processes)
+	pids, err := descendants(cmd.Process.Pid)
+	require.NoError(t, err)
+	require.Len(t, pids, 1)
+}